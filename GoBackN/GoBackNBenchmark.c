@@ -0,0 +1,741 @@
+/* Benchmarks GoBackNSender and GoBackNReceiver over loopback.
+ *
+ * Every run starts a receiver and a sender and relays their datagrams
+ * through an impairment shim in this process. The shim drops, duplicates,
+ * reorders, delays and rate limits packets in both directions. Runs are
+ * repeated for every combination of the mode, window, timeout and payload
+ * lists. The results are written as JSON lines: one "run" record per
+ * transfer and one "summary" record per combination with goodput,
+ * retransmission ratio and completion time percentiles. */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "SocketConnection.h"
+
+#define MAX_DATAGRAM 65536
+#define QUEUE_LIMIT 100000     // us of backlog before the rate limiter drops
+#define RECEIVER_LINGER "200"  // msec
+#define RECEIVER_EXIT 5000     // msec the receiver may take to write its file and exit
+#define POLL_INTERVAL 10       // msec, how often the sender is checked
+
+typedef enum {
+    TO_RECEIVER = 0,
+    TO_SENDER = 1
+} Direction;
+
+typedef struct {
+    int64_t release;  // us, CLOCK_MONOTONIC
+    Direction direction;
+    size_t length;
+    char *data;
+} Pending;
+
+typedef struct {
+    bool ok;
+    double seconds;
+    size_t packetsSent;
+    size_t payloadSize;
+} Result;
+
+// configuration
+char *modes;
+char *windows;
+char *timeouts;
+char *payloads;
+unsigned runs;
+size_t fileSize;
+double loss;
+double reorder;
+double duplicate;
+unsigned delay;         // msec, one way
+unsigned jitter;        // msec
+unsigned reorderDelay;  // msec a reordered packet is held back
+unsigned rate;          // kbit/s per direction, 0 is unlimited
+unsigned runTimeout;    // sec
+unsigned seed;
+char *outputName;
+char *senderPath;
+char *receiverPath;
+
+// relay
+int front;  // the sender talks to this socket
+int back;   // connected to the receiver
+struct sockaddr_storage senderAddr;
+socklen_t senderAddrLen;
+int64_t linkFreeAt[2];
+Pending *pending;  // min-heap by release time
+size_t pendingCount;
+size_t pendingCapacity;
+size_t relayed[2];  // per direction, counted for the current run
+size_t dropped[2];
+
+FILE *output;
+char workDir[] = "/tmp/GoBackNBenchmarkXXXXXX";
+char inputName[sizeof(workDir) + 16];
+char receivedName[sizeof(workDir) + 16];
+
+void help(int exitCode) {
+    fprintf(stderr,
+            "GoBackNBenchmark [--sender|-S path] [--receiver|-R path] "
+            "[--mode|-m list] [--window|-w list] [--timeout|-t list] "
+            "[--payload|-p list] [--runs|-n count] [--size|-s bytes] "
+            "[--loss|-l ratio] [--reorder|-o ratio] [--reorder-delay|-O msec] "
+            "[--duplicate|-u ratio] [--delay|-d msec] [--jitter|-j msec] "
+            "[--rate|-r kbit/s] [--deadline|-T sec] [--seed|-e number] "
+            "[--output|-f file]\n"
+            "lists are comma separated and every combination is run\n");
+
+    exit(exitCode);
+}
+
+void initialize(int argc, char **argv) {
+    modes = "gobackn,selective";
+    windows = "16,64,256";
+    timeouts = "200";
+    payloads = "1024";
+    runs = 5;
+    fileSize = 1 << 20;
+    loss = 0.01;
+    reorder = 0.0;
+    duplicate = 0.0;
+    delay = 1;
+    jitter = 0;
+    reorderDelay = 5;
+    rate = 0;
+    runTimeout = 60;
+    seed = 1;
+    outputName = NULL;
+    senderPath = "./GoBackNSender";
+    receiverPath = "./GoBackNReceiver";
+
+    while (1) {
+        static struct option long_options[] = {{"sender",        1, NULL, 'S'},
+                                               {"receiver",      1, NULL, 'R'},
+                                               {"mode",          1, NULL, 'm'},
+                                               {"window",        1, NULL, 'w'},
+                                               {"timeout",       1, NULL, 't'},
+                                               {"payload",       1, NULL, 'p'},
+                                               {"runs",          1, NULL, 'n'},
+                                               {"size",          1, NULL, 's'},
+                                               {"loss",          1, NULL, 'l'},
+                                               {"reorder",       1, NULL, 'o'},
+                                               {"reorder-delay", 1, NULL, 'O'},
+                                               {"duplicate",     1, NULL, 'u'},
+                                               {"delay",         1, NULL, 'd'},
+                                               {"jitter",        1, NULL, 'j'},
+                                               {"rate",          1, NULL, 'r'},
+                                               {"deadline",      1, NULL, 'T'},
+                                               {"seed",          1, NULL, 'e'},
+                                               {"output",        1, NULL, 'f'},
+                                               {"help",          0, NULL, 'h'},
+                                               {NULL,            0, NULL, 0}};
+
+        int c = getopt_long(argc, argv, "S:R:m:w:t:p:n:s:l:o:O:u:d:j:r:T:e:f:h",
+                            long_options, NULL);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'S':
+                senderPath = optarg;
+                break;
+
+            case 'R':
+                receiverPath = optarg;
+                break;
+
+            case 'm':
+                modes = optarg;
+                break;
+
+            case 'w':
+                windows = optarg;
+                break;
+
+            case 't':
+                timeouts = optarg;
+                break;
+
+            case 'p':
+                payloads = optarg;
+                break;
+
+            case 'n':
+                if (sscanf(optarg, "%u", &runs) < 1 || runs == 0) help(1);
+                break;
+
+            case 's':
+                if (sscanf(optarg, "%zu", &fileSize) < 1) help(1);
+                break;
+
+            case 'l':
+                if (sscanf(optarg, "%lf", &loss) < 1 || loss < 0 || loss >= 1) help(1);
+                break;
+
+            case 'o':
+                if (sscanf(optarg, "%lf", &reorder) < 1 || reorder < 0 || reorder > 1)
+                    help(1);
+                break;
+
+            case 'O':
+                if (sscanf(optarg, "%u", &reorderDelay) < 1) help(1);
+                break;
+
+            case 'u':
+                if (sscanf(optarg, "%lf", &duplicate) < 1 || duplicate < 0 ||
+                    duplicate > 1)
+                    help(1);
+                break;
+
+            case 'd':
+                if (sscanf(optarg, "%u", &delay) < 1) help(1);
+                break;
+
+            case 'j':
+                if (sscanf(optarg, "%u", &jitter) < 1) help(1);
+                break;
+
+            case 'r':
+                if (sscanf(optarg, "%u", &rate) < 1) help(1);
+                break;
+
+            case 'T':
+                if (sscanf(optarg, "%u", &runTimeout) < 1 || runTimeout == 0) help(1);
+                break;
+
+            case 'e':
+                if (sscanf(optarg, "%u", &seed) < 1) help(1);
+                break;
+
+            case 'f':
+                outputName = optarg;
+                break;
+
+            case 'h':
+                help(0);
+                break;
+
+            default:
+                help(1);
+        }
+    }
+
+    if (optind < argc) {
+        help(1);
+    }
+}
+
+int64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*, seeded with --seed so impairments can be repeated
+uint64_t randomState;
+
+double randomUniform() {
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return (randomState * 0x2545F4914F6CDD1DULL >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Pending datagrams */
+
+void pushPending(Pending item) {
+    if (pendingCount == pendingCapacity) {
+        pendingCapacity = pendingCapacity ? 2 * pendingCapacity : 256;
+        pending = (Pending *) realloc(pending, pendingCapacity * sizeof(Pending));
+    }
+
+    size_t i = pendingCount++;
+    while (i > 0 && pending[(i - 1) / 2].release > item.release) {
+        pending[i] = pending[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    pending[i] = item;
+}
+
+Pending popPending() {
+    Pending top = pending[0];
+    Pending last = pending[--pendingCount];
+
+    size_t i = 0;
+    while (2 * i + 1 < pendingCount) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < pendingCount && pending[child + 1].release < pending[child].release)
+            ++child;
+        if (pending[child].release >= last.release)
+            break;
+        pending[i] = pending[child];
+        i = child;
+    }
+    pending[i] = last;
+    return top;
+}
+
+void clearPending() {
+    while (pendingCount > 0) {
+        free(popPending().data);
+    }
+}
+
+/* Impairment shim */
+
+// Decides what happens to one datagram: it is dropped, or queued once or
+// twice with a release time after serialization, delay and reordering.
+void impair(Direction direction, const char *data, size_t length) {
+    if (randomUniform() < loss) {
+        ++dropped[direction];
+        return;
+    }
+
+    int copies = randomUniform() < duplicate ? 2 : 1;
+    int64_t current = now();
+    for (int i = 0; i < copies; ++i) {
+        int64_t departure = current;
+        if (rate > 0) {
+            // rate is in kbit/s, so bits * 1000 / rate is the time in us
+            int64_t transmission = (int64_t) length * 8 * 1000 / rate;
+            int64_t start = linkFreeAt[direction] > current ? linkFreeAt[direction] : current;
+            if (start - current > QUEUE_LIMIT) {
+                ++dropped[direction];
+                continue;
+            }
+            linkFreeAt[direction] = start + transmission;
+            departure = linkFreeAt[direction];
+        }
+
+        Pending item;
+        item.release = departure + (int64_t) delay * 1000 +
+                       (int64_t) (jitter * 1000 * randomUniform());
+        if (randomUniform() < reorder) {
+            item.release += (int64_t) reorderDelay * 1000;
+        }
+        item.direction = direction;
+        item.length = length;
+        item.data = (char *) malloc(length > 0 ? length : 1);
+        memcpy(item.data, data, length);
+        pushPending(item);
+    }
+}
+
+void releaseDue() {
+    int64_t current = now();
+    while (pendingCount > 0 && pending[0].release <= current) {
+        Pending item = popPending();
+        ssize_t sent;
+        if (item.direction == TO_RECEIVER) {
+            sent = send(back, item.data, item.length, 0);
+        } else {
+            sent = sendto(front, item.data, item.length, 0,
+                          (struct sockaddr *) &senderAddr, senderAddrLen);
+        }
+        // a full socket buffer or a peer that is gone is just another loss
+        if (sent < 0) {
+            ++dropped[item.direction];
+        } else {
+            ++relayed[item.direction];
+        }
+        free(item.data);
+    }
+}
+
+void relayFrom(int s, Direction direction) {
+    static char data[MAX_DATAGRAM];
+
+    while (1) {
+        struct sockaddr_storage from;
+        socklen_t fromlen = sizeof(from);
+        ssize_t length = recvfrom(s, data, sizeof(data), MSG_DONTWAIT,
+                                  (struct sockaddr *) &from, &fromlen);
+        if (length < 0) {
+            // ECONNREFUSED: the receiver is not (or no longer) there
+            return;
+        }
+        if (direction == TO_RECEIVER) {
+            senderAddr = from;
+            senderAddrLen = fromlen;
+        }
+        impair(direction, data, (size_t) length);
+    }
+}
+
+/* Processes */
+
+unsigned short localPort(int s) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    if (getsockname(s, (struct sockaddr *) &addr, &addrlen) < 0) {
+        perror("getsockname");
+        exit(1);
+    }
+    if (addr.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+    return ntohs(((struct sockaddr_in *) &addr)->sin_port);
+}
+
+// Picks a port the kernel considers free for the receiver.
+unsigned short freePort() {
+    int s = udp_server("127.0.0.1", "0", NULL);
+    if (s < 0) {
+        exit(1);
+    }
+    unsigned short port = localPort(s);
+    close(s);
+    return port;
+}
+
+// Looks for a bound UDP socket on the port in /proc/net/udp{,6}, so the
+// sender is not started before the receiver listens.
+bool isBound(unsigned short port) {
+    const char *tables[] = {"/proc/net/udp", "/proc/net/udp6"};
+    char needle[8];
+    snprintf(needle, sizeof(needle), ":%04X ", port);
+
+    for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); ++i) {
+        FILE *file = fopen(tables[i], "r");
+        if (file == NULL)
+            continue;
+
+        char line[512];
+        while (fgets(line, sizeof(line), file) != NULL) {
+            // "sl local_address rem_address ...", only the local port counts
+            char *local = strchr(line, ':');
+            char *remote = local ? strchr(local + 1, ' ') : NULL;
+            local = remote ? strchr(remote + 1, ':') : NULL;
+            if (local != NULL && strncmp(local, needle, strlen(needle)) == 0) {
+                fclose(file);
+                return true;
+            }
+        }
+        fclose(file);
+    }
+    return false;
+}
+
+pid_t spawn(char **argv, int stdoutFd) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(stdoutFd >= 0 ? stdoutFd : null, STDOUT_FILENO);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+void stopProcess(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+// Gives the process msec to exit on its own before it is stopped.
+void awaitProcess(pid_t pid, unsigned msec) {
+    int64_t deadline = now() + (int64_t) msec * 1000;
+    while (waitpid(pid, NULL, WNOHANG) == 0) {
+        if (now() > deadline) {
+            stopProcess(pid);
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+size_t parseCounter(const char *text, const char *label) {
+    const char *line = strstr(text, label);
+    size_t value = 0;
+    if (line != NULL) {
+        sscanf(line + strlen(label), "%zu", &value);
+    }
+    return value;
+}
+
+bool sameContent(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    bool same = fa != NULL && fb != NULL;
+
+    static char bufferA[65536], bufferB[65536];
+    while (same) {
+        size_t na = fread(bufferA, 1, sizeof(bufferA), fa);
+        size_t nb = fread(bufferB, 1, sizeof(bufferB), fb);
+        same = na == nb && memcmp(bufferA, bufferB, na) == 0;
+        if (na == 0)
+            break;
+    }
+    if (fa != NULL)
+        fclose(fa);
+    if (fb != NULL)
+        fclose(fb);
+    return same;
+}
+
+Result runTransfer(const char *mode, const char *window, const char *timeout,
+                   const char *payload) {
+    Result result = {false, 0, 0, 0};
+    char receiverPort[8], frontPort[8];
+    snprintf(receiverPort, sizeof(receiverPort), "%u", freePort());
+    snprintf(frontPort, sizeof(frontPort), "%u", localPort(front));
+    unlink(receivedName);
+
+    if (back >= 0) {
+        close(back);
+    }
+    back = udp_connect("127.0.0.1", receiverPort);
+    if (back < 0) {
+        exit(1);
+    }
+    clearPending();
+    linkFreeAt[TO_RECEIVER] = linkFreeAt[TO_SENDER] = 0;
+    relayed[TO_RECEIVER] = relayed[TO_SENDER] = 0;
+    dropped[TO_RECEIVER] = dropped[TO_SENDER] = 0;
+
+    char *receiverArgv[] = {receiverPath, "-l", receiverPort, "-m", (char *) mode,
+                            "-w", (char *) window, "-L", RECEIVER_LINGER,
+                            receivedName, NULL};
+    pid_t receiver = spawn(receiverArgv, -1);
+    int64_t deadline = now() + 5000000;
+    while (!isBound((unsigned short) atoi(receiverPort))) {
+        if (now() > deadline || waitpid(receiver, NULL, WNOHANG) != 0) {
+            fprintf(stderr, "receiver did not start\n");
+            stopProcess(receiver);
+            return result;
+        }
+        usleep(1000);
+    }
+
+    int pipeFds[2];
+    if (pipe(pipeFds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    char *senderArgv[] = {senderPath, "-r", frontPort, "-m", (char *) mode,
+                          "-w", (char *) window, "-t", (char *) timeout,
+                          "-p", (char *) payload, "127.0.0.1", inputName, NULL};
+    int64_t start = now();
+    pid_t sender = spawn(senderArgv, pipeFds[1]);
+    close(pipeFds[1]);
+
+    // relay until the sender is done
+    int status = -1;
+    deadline = start + (int64_t) runTimeout * 1000000;
+    while (waitpid(sender, &status, WNOHANG) == 0) {
+        if (now() > deadline) {
+            fprintf(stderr, "transfer did not finish within %u s\n", runTimeout);
+            stopProcess(sender);
+            status = -1;
+            break;
+        }
+
+        int wait = POLL_INTERVAL;
+        if (pendingCount > 0) {
+            int64_t due = (pending[0].release - now() + 999) / 1000;
+            if (due < wait)
+                wait = due < 0 ? 0 : (int) due;
+        }
+        struct pollfd fds[2] = {{front, POLLIN, 0}, {back, POLLIN, 0}};
+        if (poll(fds, 2, wait) < 0 && errno != EINTR) {
+            perror("poll");
+            exit(1);
+        }
+        if (fds[0].revents)
+            relayFrom(front, TO_RECEIVER);
+        if (fds[1].revents)
+            relayFrom(back, TO_SENDER);
+        releaseDue();
+    }
+    result.seconds = (now() - start) / 1e6;
+    // the file is complete once the receiver has exited after its linger,
+    // one that still waits for a failed transfer is stopped
+    awaitProcess(receiver, status == -1 ? 0 : RECEIVER_EXIT);
+
+    static char report[16384];
+    ssize_t length = read(pipeFds[0], report, sizeof(report) - 1);
+    close(pipeFds[0]);
+    report[length > 0 ? length : 0] = '\0';
+
+    result.packetsSent = parseCounter(report, "Packets sent:");
+    result.payloadSize = parseCounter(report, "Payload size:");
+    result.ok = status >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+                sameContent(inputName, receivedName);
+    return result;
+}
+
+/* Statistics */
+
+int compareDouble(const void *a, const void *b) {
+    double da = *(const double *) a, db = *(const double *) b;
+    return da < db ? -1 : da > db;
+}
+
+// nearest rank on sorted values
+double percentile(const double *sorted, size_t count, double p) {
+    if (count == 0)
+        return 0;
+    size_t rank = (size_t) (p / 100 * count + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// packets beyond the data packets and the final empty one, per packet needed
+double retransmissionRatio(const Result *result) {
+    if (result->payloadSize == 0)
+        return 0;
+    size_t needed = (fileSize + result->payloadSize - 1) / result->payloadSize + 1;
+    if (result->packetsSent < needed)
+        return 0;
+    return (double) (result->packetsSent - needed) / needed;
+}
+
+void writeHeader() {
+    fprintf(output,
+            "{\"type\":\"setup\",\"size\":%zu,\"runs\":%u,\"loss\":%g,\"reorder\":%g,"
+            "\"reorderDelay\":%u,\"duplicate\":%g,\"delay\":%u,\"jitter\":%u,"
+            "\"rate\":%u,\"seed\":%u}\n",
+            fileSize, runs, loss, reorder, reorderDelay, duplicate, delay, jitter,
+            rate, seed);
+}
+
+void benchmark(const char *mode, const char *window, const char *timeout,
+               const char *payload) {
+    double *times = (double *) malloc(runs * sizeof(double));
+    size_t succeeded = 0;
+    double goodputSum = 0, ratioSum = 0;
+
+    for (unsigned run = 0; run < runs; ++run) {
+        Result result = runTransfer(mode, window, timeout, payload);
+        double goodput = result.ok ? fileSize / result.seconds : 0;
+        double ratio = retransmissionRatio(&result);
+
+        fprintf(output,
+                "{\"type\":\"run\",\"mode\":\"%s\",\"window\":%s,\"timeout\":%s,"
+                "\"payload\":\"%s\",\"run\":%u,\"ok\":%s,\"seconds\":%.6f,"
+                "\"goodput\":%.0f,\"packetsSent\":%zu,\"payloadSize\":%zu,"
+                "\"retransmissionRatio\":%.6f,\"relayed\":[%zu,%zu],\"dropped\":[%zu,%zu]}\n",
+                mode, window, timeout, payload, run, result.ok ? "true" : "false",
+                result.seconds, goodput, result.packetsSent, result.payloadSize, ratio,
+                relayed[TO_RECEIVER], relayed[TO_SENDER], dropped[TO_RECEIVER],
+                dropped[TO_SENDER]);
+        fflush(output);
+
+        if (result.ok) {
+            times[succeeded++] = result.seconds;
+            goodputSum += goodput;
+            ratioSum += ratio;
+        }
+    }
+
+    qsort(times, succeeded, sizeof(double), compareDouble);
+    double n = succeeded > 0 ? succeeded : 1;
+    fprintf(output,
+            "{\"type\":\"summary\",\"mode\":\"%s\",\"window\":%s,\"timeout\":%s,"
+            "\"payload\":\"%s\",\"runs\":%u,\"failed\":%zu,\"goodput\":%.0f,"
+            "\"retransmissionRatio\":%.6f,\"p50\":%.6f,\"p90\":%.6f,\"p99\":%.6f}\n",
+            mode, window, timeout, payload, runs, runs - succeeded, goodputSum / n,
+            ratioSum / n, percentile(times, succeeded, 50),
+            percentile(times, succeeded, 90), percentile(times, succeeded, 99));
+    fflush(output);
+    free(times);
+}
+
+// Splits a comma separated list in place, the items point into it.
+size_t splitList(char *list, char **items, size_t capacity) {
+    size_t count = 0;
+    for (char *item = strtok(list, ","); item != NULL && count < capacity;
+         item = strtok(NULL, ",")) {
+        items[count++] = item;
+    }
+    return count;
+}
+
+void createInput() {
+    if (mkdtemp(workDir) == NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    snprintf(inputName, sizeof(inputName), "%s/input", workDir);
+    snprintf(receivedName, sizeof(receivedName), "%s/received", workDir);
+
+    FILE *file = fopen(inputName, "wb");
+    if (file == NULL) {
+        perror(inputName);
+        exit(1);
+    }
+    for (size_t i = 0; i < fileSize; ++i) {
+        fputc((int) (randomUniform() * 256), file);
+    }
+    fclose(file);
+}
+
+void removeInput() {
+    unlink(inputName);
+    unlink(receivedName);
+    rmdir(workDir);
+}
+
+int main(int argc, char **argv) {
+    initialize(argc, argv);
+    randomState = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    output = stdout;
+    if (outputName != NULL && (output = fopen(outputName, "w")) == NULL) {
+        perror(outputName);
+        exit(1);
+    }
+
+    front = udp_server("127.0.0.1", "0", NULL);
+    if (front < 0) {
+        exit(1);
+    }
+    udp_set_buffer_size(front, 4 << 20);
+    back = -1;
+
+    createInput();
+    writeHeader();
+
+    // the defaults are string literals, the lists are split in copies
+    char *lists[] = {strdup(modes), strdup(windows), strdup(timeouts), strdup(payloads)};
+    char *modeList[32], *windowList[32], *timeoutList[32], *payloadList[32];
+    size_t modeCount = splitList(lists[0], modeList, 32);
+    size_t windowCount = splitList(lists[1], windowList, 32);
+    size_t timeoutCount = splitList(lists[2], timeoutList, 32);
+    size_t payloadCount = splitList(lists[3], payloadList, 32);
+
+    for (size_t m = 0; m < modeCount; ++m)
+        for (size_t w = 0; w < windowCount; ++w)
+            for (size_t t = 0; t < timeoutCount; ++t)
+                for (size_t p = 0; p < payloadCount; ++p)
+                    benchmark(modeList[m], windowList[w], timeoutList[t], payloadList[p]);
+
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i)
+        free(lists[i]);
+    removeInput();
+    clearPending();
+    free(pending);
+    close(front);
+    if (back >= 0)
+        close(back);
+    if (output != stdout)
+        fclose(output);
+    return 0;
+}
@@ -8,51 +8,215 @@
  *
  **************************************************************************/
 
+#include <assert.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <errno.h>
 
 #include "GoBackNMessageStruct.h"
+#include "AsyncIo.h"
+#include "CRC.h"
+#include "Compression.h"
+#include "DataBuffer.h"
+#include "DatagramBatch.h"
+#include "Fec.h"
+#include "OutputBuffer.h"
 #include "SocketConnection.h"
-
-#define DEBUG
-#ifdef DEBUG
-#define DEBUGOUT(x, ...) fprintf(stderr, x, __VA_ARGS__)
-#else
-#define DEBUGOUT(x, ...)
-#endif
+#include "Log.h"
+#include "Trace.h"
+#include "Stats.h"
 
 #define DEFAULT_LOCAL_PORT "12105"
-#define DEFAULT_PAYLOAD_SIZE 1024
+#define DEFAULT_IO_BACKEND "select"
+#define DEFAULT_BATCH_SIZE 32
+#define DEFAULT_ACK_EVERY 2
+#define DEFAULT_ACK_DELAY 500
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define FLOW_TABLE_SIZE 256
+#define FLOW_IDLE_TIMEOUT 30  // seconds without data before a flow is dropped
+#define STREAM_TAKEOVER 1  // seconds idle before a resumed sender replaces a flow
+#define DEFAULT_LINGER 2000  // msec
+#define TRACE_RECORDS (1 << 16)
+#define DEFAULT_STATS_INTERVAL 1000  // msec
+#define CHECKPOINT_INTERVAL 1  // seconds between checkpoints of a flow
 
+// configuration, not changed any more once the workers run
 char *localPort;
-char *fileName;
+char *fileName;  // output file, the output directory in daemon mode
+unsigned window;
+TransferMode mode;
+unsigned batchSize;
+size_t maxPayloadSize;  // largest payload accepted
+unsigned ackEvery;
+struct timeval ackDelay;
+char *ioBackend;
+bool daemonMode;  // serve transfers until killed instead of a single one
+unsigned threadCount;
+struct timeval linger;  // a finished flow is kept this long after its last packet
+bool resume;  // keep checkpoints, interrupted transfers continue where they were
+unsigned fecGroupSize;  // as given to the sender, 0: no --fec
+unsigned fecParityCount;
+
+// The file a transfer is written to. The streams of a parallel transfer
+// arrive as separate flows, possibly at different workers, and write their
+// byte ranges into one file, each through its own OutputBuffer.
+typedef struct OutputFile {
+    struct OutputFile *next;
+    char name[NI_MAXHOST + 16];  // host_transferId of a parallel transfer
+    char checkpoint[PATH_MAX];   // with --resume
+    int fd;
+    uint32_t transferId;
+    unsigned streamCount;
+    unsigned flows;  // flows writing to the file
+    unsigned startedStreams, finishedStreams;
+    uint64_t size;  // end of the furthest finished range
+} OutputFile;
+
+pthread_mutex_t outputFilesLock = PTHREAD_MUTEX_INITIALIZER;
+OutputFile *outputFiles;  // parallel transfers, shared by the workers
+OutputFile *singleFile;   // opened up front when not in daemon mode
+
+// One transfer, identified by the sender's address and transferId.
+typedef struct Flow {
+    struct Flow *next;  // hash chain
+    unsigned index;     // position in Worker.flows
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint32_t transferId;
+    char name[NI_MAXHOST + NI_MAXSERV + 16];
+    bool finished;  // complete, only lingering for retransmissions
+
+    OutputFile *file;
+    OutputBuffer output;       // writes the flow's range of the file
+    unsigned streamId;
+    uint64_t rangeStart;
+    size_t bufferPayloadSize;  // payload announced by the sender
+    DataBuffer receiveBuffer;
+    FecDecoder fec;  // with --fec, allocated together with receiveBuffer
+
+    // delayed ACKs: in-order packets not acknowledged yet and the time at
+    // which they have to be acknowledged at the latest
+    unsigned delayedAcks;
+    struct timeval ackDeadline;
+    struct timeval lastActivity;
+
+    long lastReceivedSeqNo;
+    size_t goodBytes, totalBytes, acksSent;
+
+    // packets with a seqNo already received, ahead of a gap or a CRC error
+    size_t packets, duplicates, outOfOrder, corrupt;
+    size_t recovered;  // rebuilt from parity packets
+    size_t lastStatsBytes;  // goodBytes at the last --stats report
+    struct timeval lastStatsTime;
+} Flow;
+
+// Every worker owns a socket bound to the local port and the flows whose
+// datagrams the kernel delivers to it, so workers share nothing.
+typedef struct Worker {
+    pthread_t thread;
+    int s;
+    // datagrams are received straight into a ring of batchSize slots, each
+    // large enough for the largest one, allocated once with the worker
+    char *ring;
+    GoBackNMessageStruct **slots;
+    // receives into the slots and writes the flows' output (--io)
+    AsyncIo io;
 
-long lastReceivedSeqNo;
-size_t goodBytes, totalBytes;
-struct sockaddr *cliaddr;
-socklen_t len;
+    // ACKs are collected while a batch of data packets is handled and then
+    // sent with one call
+    DatagramBatch ackBatch;
+    GoBackNMessageStruct *acks;
+
+    // compressed payloads are decompressed here before they are written,
+    // inflatedPacket is the packet whose payload it holds
+    uint8_t *inflated;
+    size_t inflatedSize, inflatedLength;
+    const GoBackNMessageStruct *inflatedPacket;
+
+    Flow *table[FLOW_TABLE_SIZE];
+    Flow **flows;
+    unsigned flowCount, flowCapacity;
+    unsigned delayingFlows;  // flows with delayed ACKs
+    unsigned lingeringFlows;
+    bool done;               // single transfer complete
+    struct timeval now;      // taken once per received batch
+    struct timeval nextSweep;
+    struct timeval nextStats;
+    struct timeval nextCheckpoint;
+
+    size_t packetsReceived, bytesReceived, acksSent, acksDropped, socketSyscalls;
+} Worker;
 
 void help(int exitCode) {
-    fprintf(stderr, "GoBackNReceiver [--local|-l port] file\n");
+    fprintf(stderr,
+            "GoBackNReceiver [--local|-l port] [--mode|-m gobackn|selective] "
+            "[--window|-w count] [--batch|-b count] [--ack-every|-a count] "
+            "[--ack-delay|-d usec] [--payload|-p max-bytes] "
+            "[--daemon|-D [--threads|-T count]] [--linger|-L msec] [--resume|-R] "
+            "[--fec|-F group[:parity]] [--io|-i select|uring] [--verbose|-v] "
+            "[--trace|-x file] [--stats|-S file [--stats-interval|-I msec]] "
+            "file|directory\n");
     exit(exitCode);
 }
 
 void initialize(int argc, char **argv) {
     localPort = DEFAULT_LOCAL_PORT;
+    window = 25;
+    mode = MODE_GOBACKN;
+    batchSize = DEFAULT_BATCH_SIZE;
+    maxPayloadSize = MAX_PAYLOAD_SIZE;
+    ackEvery = DEFAULT_ACK_EVERY;
+    ackDelay.tv_sec = 0;
+    ackDelay.tv_usec = DEFAULT_ACK_DELAY;
+    daemonMode = false;
+    threadCount = 0;
+    linger.tv_sec = DEFAULT_LINGER / 1000;
+    linger.tv_usec = (DEFAULT_LINGER % 1000) * 1000;
+    resume = false;
+    fecGroupSize = 0;
+    fecParityCount = 0;
+    ioBackend = DEFAULT_IO_BACKEND;
+    char *statsName = NULL;
+    unsigned statsIntervalMs = DEFAULT_STATS_INTERVAL;
 
     while (1) {
         static struct option long_options[] = {
-                {"local", 1, NULL, 'l'},
-                {"help",  0, NULL, 'h'},
-                {0,       0, 0,    0}};
+                {"local",          1, NULL, 'l'},
+                {"mode",           1, NULL, 'm'},
+                {"window",         1, NULL, 'w'},
+                {"batch",          1, NULL, 'b'},
+                {"ack-every",      1, NULL, 'a'},
+                {"ack-delay",      1, NULL, 'd'},
+                {"payload",        1, NULL, 'p'},
+                {"daemon",         0, NULL, 'D'},
+                {"threads",        1, NULL, 'T'},
+                {"linger",         1, NULL, 'L'},
+                {"resume",         0, NULL, 'R'},
+                {"fec",            1, NULL, 'F'},
+                {"io",             1, NULL, 'i'},
+                {"verbose",        0, NULL, 'v'},
+                {"trace",          1, NULL, 'x'},
+                {"stats",          1, NULL, 'S'},
+                {"stats-interval", 1, NULL, 'I'},
+                {"help",           0, NULL, 'h'},
+                {0,                0, 0,    0}};
 
-        int c = getopt_long(argc, argv, "l:h", long_options, NULL);
+        int c = getopt_long(argc, argv, "l:m:w:b:a:d:p:DT:L:RF:i:vx:S:I:h", long_options,
+                            NULL);
         if (c == -1) break;
 
         switch (c) {
@@ -60,6 +224,86 @@ void initialize(int argc, char **argv) {
                 localPort = optarg;
                 break;
 
+            case 'm':
+                if (!parseTransferMode(optarg, &mode)) help(1);
+                break;
+
+            case 'w':
+                if (sscanf(optarg, "%u", &window) < 1) help(1);
+                break;
+
+            case 'b':
+                if (sscanf(optarg, "%u", &batchSize) < 1) help(1);
+                break;
+
+            case 'a':
+                if (sscanf(optarg, "%u", &ackEvery) < 1) help(1);
+                break;
+
+            case 'd': {
+                unsigned usec;
+                if (sscanf(optarg, "%u", &usec) < 1) help(1);
+                ackDelay.tv_sec = usec / 1000000;
+                ackDelay.tv_usec = usec % 1000000;
+            }
+                break;
+
+            case 'p':
+                if (sscanf(optarg, "%zu", &maxPayloadSize) < 1 ||
+                    maxPayloadSize == 0 || maxPayloadSize > MAX_PAYLOAD_SIZE)
+                    help(1);
+                break;
+
+            case 'D':
+                daemonMode = true;
+                break;
+
+            case 'T':
+                if (sscanf(optarg, "%u", &threadCount) < 1 || threadCount == 0)
+                    help(1);
+                break;
+
+            case 'L': {
+                unsigned msec;
+                if (sscanf(optarg, "%u", &msec) < 1) help(1);
+                linger.tv_sec = msec / 1000;
+                linger.tv_usec = (msec % 1000) * 1000;
+            }
+                break;
+
+            case 'R':
+                resume = true;
+                break;
+
+            case 'F':
+                if (!parseFecSpec(optarg, &fecGroupSize, &fecParityCount)) help(1);
+                break;
+
+            case 'i':
+                if (!isAsyncIoBackend(optarg)) help(1);
+                ioBackend = optarg;
+                break;
+
+            case 'v':
+                ++logLevel;
+                break;
+
+            case 'x':
+                if (!openTrace(optarg, TRACE_RECORDS)) {
+                    perror(optarg);
+                    exit(1);
+                }
+                break;
+
+            case 'S':
+                statsName = optarg;
+                break;
+
+            case 'I':
+                if (sscanf(optarg, "%u", &statsIntervalMs) < 1 || statsIntervalMs == 0)
+                    help(1);
+                break;
+
             case 'h':
                 help(0);
                 break;
@@ -73,133 +317,1084 @@ void initialize(int argc, char **argv) {
         }
     }
 
-    if (argc < optind + 1) help(1);
+    if (argc < optind + 1 || window <= 0 || batchSize <= 0 || ackEvery <= 0)
+        help(1);
+    if (threadCount > 0 && !daemonMode) help(1);
+    if (statsName != NULL && !openStats(statsName, statsIntervalMs)) {
+        perror(statsName);
+        exit(1);
+    }
 
     fileName = argv[optind];
 
-    lastReceivedSeqNo = -1;
-    goodBytes = totalBytes = 0;
+    if (!daemonMode) {
+        threadCount = 1;
+    } else if (threadCount == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cpus > 0 ? (unsigned) cpus : 1;
+    }
+}
+
+// Monotonic like the sender's, ACK delays and idle timeouts must not
+// depend on wall clock adjustments.
+void now(struct timeval *tv) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        perror("clock_gettime");
+        exit(1);
+    }
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+unsigned hashFlow(const struct sockaddr *addr, socklen_t addrlen,
+                  uint32_t transferId) {
+    // FNV-1a
+    uint32_t hash = 2166136261u ^ transferId;
+    const unsigned char *bytes = (const unsigned char *) addr;
+    for (socklen_t i = 0; i < addrlen; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash % FLOW_TABLE_SIZE;
+}
+
+Flow *findFlow(Worker *worker, const struct sockaddr *addr, socklen_t addrlen,
+               uint32_t transferId) {
+    Flow *flow = worker->table[hashFlow(addr, addrlen, transferId)];
+    while (flow != NULL &&
+           (flow->transferId != transferId || flow->addrlen != addrlen ||
+            memcmp(&flow->addr, addr, addrlen) != 0)) {
+        flow = flow->next;
+    }
+    return flow;
+}
+
+// With --resume the position up to which every stream of a transfer is on
+// disk is kept in a checkpoint next to the output: "transferId streamCount"
+// followed by one position per stream. A sender that asks where to continue
+// gets it, the checkpoint is removed once the file is complete.
+void checkpointPath(char *path, size_t size, const char *host, uint32_t transferId) {
+    if (daemonMode) {
+        snprintf(path, size, "%s/%s_%08" PRIx32 ".checkpoint", fileName, host, transferId);
+    } else {
+        snprintf(path, size, "%s.checkpoint", fileName);
+    }
+}
+
+// Fills positions (streamCount entries) if the checkpoint belongs to the
+// transfer.
+bool readCheckpoint(const char *path, uint32_t transferId, unsigned streamCount,
+                    uint64_t *positions) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    uint32_t id;
+    unsigned count;
+    bool valid = fscanf(f, "%" SCNx32 " %u", &id, &count) == 2 &&
+                 id == transferId && count == streamCount;
+    for (unsigned i = 0; valid && i < streamCount; ++i) {
+        valid = fscanf(f, "%" SCNu64, &positions[i]) == 1;
+    }
+    fclose(f);
+    return valid;
+}
+
+// Replaces the checkpoint atomically, a crash leaves the old one behind.
+void writeCheckpoint(const char *path, uint32_t transferId, unsigned streamCount,
+                     const uint64_t *positions) {
+    char tmpPath[PATH_MAX + 4];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *f = fopen(tmpPath, "w");
+    if (f == NULL) {
+        perror(tmpPath);
+        return;
+    }
+    fprintf(f, "%08" PRIx32 " %u\n", transferId, streamCount);
+    for (unsigned i = 0; i < streamCount; ++i) {
+        fprintf(f, "%" PRIu64 "\n", positions[i]);
+    }
+    if (fflush(f) != 0 || fdatasync(fileno(f)) < 0) {
+        perror(tmpPath);
+    }
+    fclose(f);
+    if (rename(tmpPath, path) < 0) {
+        perror(path);
+    }
+}
+
+// Records that a stream is on disk up to position. Positions only move
+// forward, a stale flow of an earlier attempt that times out late does not
+// undo the progress of the current one. Called with outputFilesLock held.
+void storeCheckpoint(OutputFile *file, unsigned streamId, uint64_t position) {
+    if (file->checkpoint[0] == '\0' || file->finishedStreams >= file->streamCount ||
+        streamId >= file->streamCount) {
+        return;
+    }
+    uint64_t *positions = (uint64_t *) calloc(file->streamCount, sizeof(uint64_t));
+    if (!readCheckpoint(file->checkpoint, file->transferId, file->streamCount,
+                        positions)) {
+        memset(positions, 0, file->streamCount * sizeof(uint64_t));
+    }
+    if (position > positions[streamId]) {
+        positions[streamId] = position;
+        writeCheckpoint(file->checkpoint, file->transferId, file->streamCount, positions);
+    }
+    free(positions);
+}
+
+// Outputs of the daemon are named after the sender and the transfer, e.g.
+// dir/127.0.0.1_39513_5f1e2a3b, the streams of a parallel transfer (and, with
+// --resume, every transfer) share dir/127.0.0.1_5f1e2a3b. These files are not
+// truncated, a stream that starts after the others have finished (and the
+// file has been closed) only writes its own range again. A file gets its
+// size once all streams are complete. A single receiver only takes the first
+// transfer.
+OutputFile *acquireOutputFile(const char *host, const char *name,
+                              const GoBackNMessageStruct *first) {
+    OutputFile *file = NULL;
+    bool parallel = first->streamCount > 1;
+    bool shared = parallel || resume;
+
+    pthread_mutex_lock(&outputFilesLock);
+    if (!daemonMode) {
+        if (singleFile->startedStreams == 0 ||
+            (parallel && singleFile->transferId == first->transferId &&
+             singleFile->startedStreams < singleFile->streamCount)) {
+            file = singleFile;
+        }
+    } else if (shared) {
+        char sharedName[sizeof(file->name)];
+        snprintf(sharedName, sizeof(sharedName), "%s_%08" PRIx32, host, first->transferId);
+        for (file = outputFiles; file != NULL; file = file->next) {
+            if (strcmp(file->name, sharedName) == 0) break;
+        }
+        if (file == NULL) {
+            file = (OutputFile *) calloc(1, sizeof(OutputFile));
+            strcpy(file->name, sharedName);
+            name = sharedName;
+        }
+    } else {
+        file = (OutputFile *) calloc(1, sizeof(OutputFile));
+    }
+
+    if (file != NULL && file->flows == 0 && file != singleFile) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", fileName, name);
+        // read back for MESSAGE_VERIFY
+        file->fd = open(path, O_RDWR | O_CREAT | (shared ? 0 : O_TRUNC), 0644);
+        if (file->fd < 0) {
+            perror(path);
+            free(file);
+            file = NULL;
+        } else if (shared) {
+            file->next = outputFiles;
+            outputFiles = file;
+            if (resume) {
+                checkpointPath(file->checkpoint, sizeof(file->checkpoint), host,
+                               first->transferId);
+            }
+        }
+    }
+    if (file != NULL) {
+        if (file->startedStreams == 0) {
+            file->transferId = first->transferId;
+            file->streamCount = parallel ? first->streamCount : 1;
+        }
+        ++file->flows;
+        ++file->startedStreams;
+    }
+    pthread_mutex_unlock(&outputFilesLock);
+    return file;
+}
+
+void saveCheckpoint(OutputFile *file, unsigned streamId, uint64_t position) {
+    pthread_mutex_lock(&outputFilesLock);
+    storeCheckpoint(file, streamId, position);
+    pthread_mutex_unlock(&outputFilesLock);
+}
+
+// A stream has written its whole range.
+void finishOutputFile(OutputFile *file, unsigned streamId, uint64_t end) {
+    pthread_mutex_lock(&outputFilesLock);
+    storeCheckpoint(file, streamId, end);
+    ++file->finishedStreams;
+    if (end > file->size) {
+        file->size = end;
+    }
+    if (file->finishedStreams == file->streamCount) {
+        if (ftruncate(file->fd, (off_t) file->size) < 0) {
+            perror("ftruncate");
+        }
+        if (file->checkpoint[0] != '\0' && unlink(file->checkpoint) < 0 &&
+            errno != ENOENT) {
+            perror(file->checkpoint);
+        }
+        if (file->streamCount > 1) {
+            LOG_INFO("FILE: all %u streams of %08" PRIx32 " complete\n",
+                     file->streamCount, file->transferId);
+        }
+    }
+    pthread_mutex_unlock(&outputFilesLock);
+}
+
+void releaseOutputFile(OutputFile *file) {
+    pthread_mutex_lock(&outputFilesLock);
+    if (--file->flows == 0 && file != singleFile) {
+        OutputFile **link = &outputFiles;
+        while (*link != NULL && *link != file) {
+            link = &(*link)->next;
+        }
+        if (*link != NULL) {
+            *link = file->next;
+        }
+        if (close(file->fd) < 0) {
+            perror("close");
+        }
+        free(file);
+    }
+    pthread_mutex_unlock(&outputFilesLock);
+}
+
+bool isSingleFileComplete(void) {
+    pthread_mutex_lock(&outputFilesLock);
+    bool complete = singleFile->startedStreams > 0 &&
+                    singleFile->finishedStreams >= singleFile->streamCount;
+    pthread_mutex_unlock(&outputFilesLock);
+    return complete;
+}
+
+Flow *createFlow(Worker *worker, const struct sockaddr *addr, socklen_t addrlen,
+                 const GoBackNMessageStruct *first) {
+    uint32_t transferId = first->transferId;
+    char host[NI_MAXHOST], serv[NI_MAXSERV];
+    if (getnameinfo(addr, addrlen, host, sizeof(host), serv, sizeof(serv),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        return NULL;
+    }
+
+    Flow *flow = (Flow *) calloc(1, sizeof(Flow));
+    memcpy(&flow->addr, addr, addrlen);
+    flow->addrlen = addrlen;
+    flow->transferId = transferId;
+    snprintf(flow->name, sizeof(flow->name), "%s_%s_%08" PRIx32, host, serv,
+             transferId);
+
+    flow->file = acquireOutputFile(host, flow->name, first);
+    if (flow->file == NULL) {
+        free(flow);
+        return NULL;
+    }
+    flow->streamId = first->streamId;
+    flow->rangeStart = first->offset;
+    flow->output = openOutputRange(flow->file->fd, (off_t) first->offset,
+                                   OUTPUT_BUFFER_SIZE, &worker->io);
+    if (flow->output == NULL) {
+        perror("openOutputRange");
+        exit(1);
+    }
+
+    // allocated once the sender's payload size is known
+    flow->receiveBuffer = NULL;
+    flow->lastReceivedSeqNo = -1;
+    flow->lastActivity = worker->now;
+    flow->lastStatsTime = worker->now;
+
+    unsigned bucket = hashFlow(addr, addrlen, transferId);
+    flow->next = worker->table[bucket];
+    worker->table[bucket] = flow;
+
+    if (worker->flowCount == worker->flowCapacity) {
+        worker->flowCapacity = worker->flowCapacity ? 2 * worker->flowCapacity : 16;
+        worker->flows = (Flow **) realloc(worker->flows,
+                                          worker->flowCapacity * sizeof(Flow *));
+    }
+    flow->index = worker->flowCount++;
+    worker->flows[flow->index] = flow;
+
+    LOG_INFO("FLOW: %s started\n", flow->name);
+    return flow;
+}
+
+void removeFlow(Worker *worker, Flow *flow) {
+    Flow **link = &worker->table[hashFlow((struct sockaddr *) &flow->addr,
+                                          flow->addrlen, flow->transferId)];
+    while (*link != flow) {
+        link = &(*link)->next;
+    }
+    *link = flow->next;
+
+    Flow *last = worker->flows[--worker->flowCount];
+    worker->flows[flow->index] = last;
+    last->index = flow->index;
+
+    if (flow->delayedAcks > 0) {
+        --worker->delayingFlows;
+    }
+    if (flow->finished) {
+        --worker->lingeringFlows;
+    }
+    if (flow->receiveBuffer != NULL) {
+        deallocateDataBuffer(flow->receiveBuffer);
+    }
+    if (flow->fec != NULL) {
+        destroyFecDecoder(flow->fec);
+    }
+    releaseOutputFile(flow->file);
+    free(flow);
+}
+
+// Writes out what the flow has buffered and records how far its range is on
+// disk. The data is synced before the checkpoint claims it.
+void checkpointFlow(Flow *flow) {
+    if (flow->output == NULL || flow->file->checkpoint[0] == '\0') {
+        return;
+    }
+    flushOutputBuffer(flow->output);
+    if (fdatasync(flow->file->fd) < 0) {
+        perror("fdatasync");
+    }
+    saveCheckpoint(flow->file, flow->streamId, flow->rangeStart + flow->goodBytes);
+}
+
+// A sender restarted with --resume comes back from another port. The flow
+// of its earlier attempt is dropped once it is idle, which hands the stream
+// of the single transfer over to the new one.
+void takeOverStream(Worker *worker, const GoBackNMessageStruct *first) {
+    for (unsigned i = worker->flowCount; i-- > 0;) {
+        Flow *flow = worker->flows[i];
+        if (flow->finished || flow->transferId != first->transferId ||
+            flow->streamId != first->streamId ||
+            worker->now.tv_sec - flow->lastActivity.tv_sec <= STREAM_TAKEOVER) {
+            continue;
+        }
+        LOG_INFO("FLOW: %s replaced after %zu bytes\n", flow->name, flow->goodBytes);
+        checkpointFlow(flow);
+        closeOutputBuffer(flow->output);
+        pthread_mutex_lock(&outputFilesLock);
+        --flow->file->startedStreams;
+        pthread_mutex_unlock(&outputFilesLock);
+        removeFlow(worker, flow);
+    }
 }
 
-void writeBuffer(FILE *file, GoBackNMessageStruct *packet) {
+void writeBuffer(OutputBuffer output, GoBackNMessageStruct *packet) {
     size_t count = packet->size - sizeof(*packet);
-    size_t retval;
-    if ((retval = fwrite(packet->data, 1, count, file)) < count) {
-        if (ferror(file)) {
-            perror("fread");
-            exit(1);
-        } else {
-            fprintf(stderr, "WARNING: Could not write complete packet to file!\n");
+    appendToOutputBuffer(output, packet->data, count);
+    LOG_DEBUG("FILE: %zu bytes buffered\n", count);
+}
+
+void flushAcks(Worker *worker) {
+    if (getBatchCount(worker->ackBatch) == 0) {
+        return;
+    }
+
+    // sendmmsg() stops at the first ACK that cannot be sent and reports the
+    // error on the next call. Such an ACK is dropped, the other transfers of
+    // the worker must go on and the sender retransmits anyway.
+    size_t count = getBatchCount(worker->ackBatch);
+    for (size_t sent = 0; sent < count;) {
+        int retval = sendBatchFrom(worker->s, worker->ackBatch, sent, 0);
+        ++worker->socketSyscalls;
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_WARNING("sendmmsg: %s, ACK dropped\n", strerror(errno));
+            ++worker->acksDropped;
+            ++sent;
+            continue;
         }
+        LOG_DEBUG("SOCKET: %d ACKs sent\n", retval);
+        sent += retval;
     }
-    DEBUGOUT("FILE: %zu bytes written\n", retval);
+    clearBatch(worker->ackBatch);
 }
 
-void sendAck(int s, GoBackNMessageStruct *packet, long expected) {
-    GoBackNMessageStruct *ack = allocateGoBackNMessageStruct(0);
-    ack->seqNo = -1;
+void sendAck(Worker *worker, Flow *flow, long seqNo, long expected) {
+    if (getBatchCount(worker->ackBatch) == getBatchCapacity(worker->ackBatch)) {
+        flushAcks(worker);
+    }
+
+    GoBackNMessageStruct *ack = &worker->acks[getBatchCount(worker->ackBatch)];
+    initGoBackNMessageStruct(ack, MESSAGE_ACK);
+    ack->seqNo = seqNo;
     ack->seqNoExpected = expected;
+    ack->transferId = flow->transferId;
     ack->size = sizeof(*ack);
     ack->crcSum = 0;
     ack->crcSum = crcGoBackNMessageStruct(ack);
 
-    int retval;
-    if ((retval = sendto(s, ack, ack->size, 0, cliaddr, len)) < 0) {
-        perror("send");
-        exit(1);
+    addToBatch(worker->ackBatch, ack, ack->size, (struct sockaddr *) &flow->addr,
+               flow->addrlen);
+    ++flow->acksSent;
+    ++worker->acksSent;
+    TRACE(TRACE_ACK_SENT, flow->transferId, seqNo, expected);
+}
+
+// Control messages are rare, they are answered right away.
+void sendControl(Worker *worker, GoBackNMessageStruct *reply, const struct sockaddr *to,
+                 socklen_t tolen) {
+    reply->crcSum = 0;
+    reply->crcSum = crcGoBackNMessageStruct(reply);
+    if (sendto(worker->s, reply, reply->size, 0, to, tolen) < 0) {
+        // the sender asks again
+        LOG_WARNING("sendto: %s, reply dropped\n", strerror(errno));
     }
-    DEBUGOUT("SOCKET: %d bytes sent\n", retval);
-    freeGoBackNMessageStruct(ack);
+    ++worker->socketSyscalls;
 }
 
-int main(int argc, char **argv) {
-    socklen_t addrlen;
+// Where the byte range starting at request->offset continues, the start
+// unless a checkpoint of the transfer says otherwise.
+void answerResume(Worker *worker, const GoBackNMessageStruct *request,
+                  const struct sockaddr *from, socklen_t fromlen) {
+    GoBackNMessageStruct reply = *request;
+    reply.size = sizeof(reply);
 
-    initialize(argc, argv);
+    char host[NI_MAXHOST], path[PATH_MAX];
+    if (resume && request->streamId < request->streamCount &&
+        getnameinfo(from, fromlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST) == 0) {
+        checkpointPath(path, sizeof(path), host, request->transferId);
+        uint64_t *positions = (uint64_t *) calloc(request->streamCount,
+                                                  sizeof(uint64_t));
+        pthread_mutex_lock(&outputFilesLock);
+        bool found = readCheckpoint(path, request->transferId, request->streamCount,
+                                    positions);
+        pthread_mutex_unlock(&outputFilesLock);
+        if (found && positions[request->streamId] > reply.offset) {
+            reply.offset = positions[request->streamId];
+            LOG_INFO("FLOW: %08" PRIx32 " stream %u resumes at %" PRIu64 "\n",
+                     request->transferId, request->streamId, reply.offset);
+        }
+        free(positions);
+    }
+    sendControl(worker, &reply, from, fromlen);
+}
 
-    // open file
-    FILE *output = fopen(fileName, "wb");
-    if (output == NULL) {
-        perror("fopen");
-        exit(1);
+// Checksum of what the finished flow has written from request->offset on,
+// the sender compares it with its own.
+void answerVerify(Worker *worker, Flow *flow, const GoBackNMessageStruct *request) {
+    struct {
+        GoBackNMessageStruct header;
+        RangeChecksum checksum;
+    } __attribute__((packed)) reply;
+    reply.header = *request;
+    reply.header.size = sizeof(reply);
+
+    uint64_t end = flow->rangeStart + flow->goodBytes;
+    uint32_t crc = 0;
+    int64_t covered = request->offset <= end
+                      ? crc32File(flow->file->fd, request->offset, end - request->offset, &crc)
+                      : 0;
+    if (covered < 0) {
+        perror("pread");
+        return;
     }
+    reply.checksum.length = (uint64_t) covered;
+    reply.checksum.crc = crc;
+    LOG_INFO("FLOW: %s checksum %08" PRIx32 " over %" PRId64 " bytes\n", flow->name, crc,
+             covered);
+    sendControl(worker, &reply.header, (struct sockaddr *) &flow->addr, flow->addrlen);
+}
 
-    // prepare channel to receiver
-    int s = udp_server(NULL, localPort, &addrlen);
-    if (s < 0) {
-        exit(1);
+// In-order packets (delay) are acknowledged for every ackEvery packets or
+// once ackDelay has passed, everything else (gaps, duplicates, CRC errors,
+// the last packet) at once. The ACK is cumulative, so it also covers the
+// delayed ones.
+void acknowledge(Worker *worker, Flow *flow, long seqNo, bool delay) {
+    if (delay && ++flow->delayedAcks < ackEvery) {
+        if (flow->delayedAcks == 1) {
+            struct timeval currentTime;
+            now(&currentTime);
+            timeradd(&currentTime, &ackDelay, &flow->ackDeadline);
+            ++worker->delayingFlows;
+        }
+        return;
     }
-    cliaddr = malloc(addrlen);
-    len = addrlen;
 
-    ssize_t bytesRead = 0;
-    while (1) {
-        bool crcValid = false;
-        uint32_t tmpCRC = 0;
+    // with delay set, delayedAcks already counts this packet
+    if (flow->delayedAcks > (delay ? 1u : 0u)) {
+        --worker->delayingFlows;
+    }
+    flow->delayedAcks = 0;
+    sendAck(worker, flow, seqNo, flow->lastReceivedSeqNo + 1);
+}
 
-        GoBackNMessageStruct *data =
-                allocateGoBackNMessageStruct(DEFAULT_PAYLOAD_SIZE);
-        if (recvfrom(s, data, sizeof(*data), MSG_PEEK, cliaddr, &len) < 0) {
-            perror("recv(MSG_PEEK)");
-            exit(1);
+void printStatistics(const Worker *worker, const Flow *flow) {
+    flockfile(stdout);
+    if (daemonMode) {
+        printf("Transfer %s:\n", flow->name);
+    }
+    printf("Total bytes: %zu\nGood bytes: %zu\n", flow->totalBytes, flow->goodBytes);
+    printf("ACKs sent: %zu\n", flow->acksSent);
+    if (fecGroupSize > 0) {
+        printf("Recovered packets: %zu\n", flow->recovered);
+    }
+
+    // Without batching every datagram costs a recvfrom() and every ACK a
+    // sendto(), the difference to the calls actually made is what batching
+    // saved. The calls are counted per worker, so only a single transfer
+    // gets them.
+    if (!daemonMode) {
+        if (worker->acksDropped > 0) {
+            printf("ACKs dropped: %zu\n", worker->acksDropped);
+        }
+        size_t unbatched = worker->packetsReceived + worker->acksSent;
+        size_t syscalls = worker->socketSyscalls + worker->io.syscalls;
+        double megabytes = worker->bytesReceived / (1024.0 * 1024.0);
+        printf("Socket syscalls: %zu (unbatched: %zu, saved per MB: %.1f)\n",
+               syscalls, unbatched,
+               megabytes > 0 ? (unbatched - syscalls) / megabytes : 0.0);
+    }
+    printf("\n");
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+// One --stats record, goodput is measured since the previous one.
+void reportStatistics(Flow *flow, const char *state) {
+    struct timeval currentTime, elapsed;
+    now(&currentTime);
+    timersub(&currentTime, &flow->lastStatsTime, &elapsed);
+
+    writeStats("\"program\":\"receiver\",\"transfer\":\"%08x\",\"flow\":\"%s\","
+               "\"state\":\"%s\",\"packetsReceived\":%zu,\"totalBytes\":%zu,"
+               "\"goodBytes\":%zu,\"duplicates\":%zu,\"outOfOrder\":%zu,"
+               "\"corrupt\":%zu,\"recovered\":%zu,\"acksSent\":%zu,\"expected\":%ld,\"buffered\":%zu,"
+               "\"window\":%u,\"goodput\":%.0f",
+               flow->transferId, flow->name, state, flow->packets, flow->totalBytes,
+               flow->goodBytes, flow->duplicates, flow->outOfOrder, flow->corrupt,
+               flow->recovered, flow->acksSent, flow->lastReceivedSeqNo + 1,
+               flow->receiveBuffer != NULL ? getBufferSize(flow->receiveBuffer) : 0,
+               window, statsRate(flow->goodBytes, flow->lastStatsBytes, &elapsed));
+
+    flow->lastStatsBytes = flow->goodBytes;
+    flow->lastStatsTime = currentTime;
+}
+
+// The whole file has been received. The flow lingers until the sender has
+// been quiet for the linger time: if the final ACK got lost, the sender
+// retransmits the last packets and they are acknowledged again. A single
+// transfer ends the receiver after that.
+void finish(Worker *worker, Flow *flow) {
+    // the final ACK goes out once the range is in the file, a sender that
+    // is done may rely on it
+    closeOutputBuffer(flow->output);
+    flow->output = NULL;
+    if (flow->file->checkpoint[0] != '\0' && fdatasync(flow->file->fd) < 0) {
+        perror("fdatasync");
+    }
+    finishOutputFile(flow->file, flow->streamId, flow->rangeStart + flow->goodBytes);
+    flushAcks(worker);
+    printStatistics(worker, flow);
+    if (statsFile != NULL) {
+        reportStatistics(flow, "finished");
+    }
+    LOG_INFO("FLOW: %s finished\n", flow->name);
+
+    if (flow->receiveBuffer != NULL) {
+        deallocateDataBuffer(flow->receiveBuffer);
+        flow->receiveBuffer = NULL;
+    }
+    if (flow->fec != NULL) {
+        destroyFecDecoder(flow->fec);
+        flow->fec = NULL;
+    }
+    flow->finished = true;
+    ++worker->lingeringFlows;
+}
+
+// Sends the delayed ACKs that are due, ends lingering flows, takes
+// checkpoints and, in daemon mode, drops flows the sender has given up on.
+// Returns false if no timer is pending, otherwise the time until the next one
+// is due in wait.
+bool processTimers(Worker *worker, struct timeval *wait) {
+    if (worker->delayingFlows == 0 && worker->lingeringFlows == 0 && !daemonMode &&
+        statsFile == NULL && !resume) {
+        return false;
+    }
+
+    struct timeval currentTime, next;
+    now(&currentTime);
+    next.tv_sec = LONG_MAX;
+    next.tv_usec = 0;
+
+    bool sweep = daemonMode && !timercmp(&currentTime, &worker->nextSweep, <);
+    if (sweep) {
+        worker->nextSweep = currentTime;
+        worker->nextSweep.tv_sec += 1;
+    }
+    bool report = statsFile != NULL && statsDue(&worker->nextStats, &currentTime);
+    bool checkpoint = resume && !timercmp(&currentTime, &worker->nextCheckpoint, <);
+    if (checkpoint) {
+        worker->nextCheckpoint = currentTime;
+        worker->nextCheckpoint.tv_sec += CHECKPOINT_INTERVAL;
+    }
+
+    for (unsigned i = worker->flowCount; i-- > 0;) {
+        Flow *flow = worker->flows[i];
+
+        if (flow->finished) {
+            struct timeval end;
+            timeradd(&flow->lastActivity, &linger, &end);
+            if (timercmp(&end, &currentTime, >)) {
+                if (timercmp(&end, &next, <)) next = end;
+            } else {
+                removeFlow(worker, flow);
+                // a single receiver waits for all streams of the transfer
+                worker->done = !daemonMode && worker->flowCount == 0 &&
+                               isSingleFileComplete();
+            }
+            continue;
+        }
+        if (report) {
+            reportStatistics(flow, "running");
+        }
+        if (checkpoint) {
+            checkpointFlow(flow);
         }
 
-        if (data->size > (sizeof(GoBackNMessageStruct) + DEFAULT_PAYLOAD_SIZE)) {
-            data->size = sizeof(GoBackNMessageStruct) + DEFAULT_PAYLOAD_SIZE;
+        if (flow->delayedAcks > 0) {
+            if (timercmp(&flow->ackDeadline, &currentTime, >)) {
+                if (timercmp(&flow->ackDeadline, &next, <)) next = flow->ackDeadline;
+            } else {
+                acknowledge(worker, flow, -1, false);
+            }
         }
 
-        bytesRead = recvfrom(s, data, data->size, 0, cliaddr, &len);
-        if (bytesRead < 0) {
-            perror("recv");
-            exit(1);
+        if (sweep && currentTime.tv_sec - flow->lastActivity.tv_sec > FLOW_IDLE_TIMEOUT) {
+            LOG_WARNING("Transfer %s timed out after %zu bytes\n", flow->name,
+                        flow->goodBytes);
+            checkpointFlow(flow);
+            closeOutputBuffer(flow->output);
+            removeFlow(worker, flow);
         }
-        if (bytesRead < data->size) {
-            fprintf(stderr, "WARNING: Truncated read\n");
-            data->size = bytesRead;
+    }
+
+    if (daemonMode && timercmp(&worker->nextSweep, &next, <)) {
+        next = worker->nextSweep;
+    }
+    if (statsFile != NULL && timercmp(&worker->nextStats, &next, <)) {
+        next = worker->nextStats;
+    }
+    if (resume && timercmp(&worker->nextCheckpoint, &next, <)) {
+        next = worker->nextCheckpoint;
+    }
+    if (next.tv_sec == LONG_MAX) {
+        return false;
+    }
+    if (timercmp(&next, &currentTime, >)) {
+        timersub(&next, &currentTime, wait);
+    } else {
+        timerclear(wait);
+    }
+    return true;
+}
+
+// A compressed payload that does not decompress counts as corrupt, like a
+// CRC error: it is neither delivered nor acknowledged, so the sender sends
+// it again. The next in-order packet is decompressed right away for
+// deliver(), packets that may be kept out of order are only checked.
+// Duplicates and packets that are dropped anyway are not looked at.
+bool isIntact(Worker *worker, const Flow *flow, const GoBackNMessageStruct *packet) {
+    worker->inflatedPacket = NULL;
+    if (packet->type != MESSAGE_DATA || !(packet->flags & FLAG_COMPRESSED) ||
+        flow->finished || packet->seqNo <= flow->lastReceivedSeqNo ||
+        (packet->seqNo > flow->lastReceivedSeqNo + 1 &&
+         mode != MODE_SELECTIVE && fecGroupSize == 0)) {
+        return true;
+    }
+
+    bool inOrder = packet->seqNo == flow->lastReceivedSeqNo + 1;
+    size_t length;
+    if (decompressPayload(packet->data, packet->size - sizeof(*packet),
+                          inOrder ? worker->inflated : NULL, worker->inflatedSize, &length)) {
+        if (inOrder) {
+            worker->inflatedPacket = packet;
+            worker->inflatedLength = length;
         }
+        return true;
+    }
+    LOG_WARNING("Packet #%" PRId64 " does not decompress\n", packet->seqNo);
+    return false;
+}
 
-        DEBUGOUT("SOCKET: %zd bytes received.\n", bytesRead);
+// Writes the next in-order packet, returns true if it was the (empty) last one.
+bool deliver(Worker *worker, Flow *flow, GoBackNMessageStruct *packet) {
+    if (packet->size == sizeof(*packet)) {
+        return true;
+    }
+    if (!(packet->flags & FLAG_COMPRESSED)) {
+        flow->goodBytes += packet->size - sizeof(*packet);
+        writeBuffer(flow->output, packet);
+        return false;
+    }
 
-        if (bytesRead == 0) {
-            freeGoBackNMessageStruct(data);
-            break;
+    size_t length = worker->inflatedLength;
+    if (packet != worker->inflatedPacket) {
+        // a buffered packet, checked by isIntact() when it arrived
+        bool intact = decompressPayload(packet->data, packet->size - sizeof(*packet),
+                                        worker->inflated, worker->inflatedSize, &length);
+        assert(intact);
+        (void) intact;
+    }
+    worker->inflatedPacket = NULL;
+    flow->goodBytes += length;
+    appendToOutputBuffer(flow->output, worker->inflated, length);
+    LOG_DEBUG("FILE: %zu bytes buffered\n", length);
+    return false;
+}
+
+// Selective repeat: every packet inside the receive window is kept, the
+// in-order prefix of the buffer is written out and every packet is
+// acknowledged individually (seqNo) as well as cumulatively (seqNoExpected).
+// In-order packets are written straight from the receive slot, only
+// out-of-order ones are copied into the buffer.
+void receiveSelective(Worker *worker, Flow *flow, GoBackNMessageStruct *data,
+                      bool crcValid) {
+    if (!crcValid) {
+        acknowledge(worker, flow, -1, false);
+        return;
+    }
+
+    // selective repeat keeps out-of-order packets of the current window,
+    // every slot as large as the payload the sender announces
+    if (flow->receiveBuffer == NULL) {
+        flow->bufferPayloadSize = data->payloadSize <= maxPayloadSize
+                                  ? (size_t) data->payloadSize : maxPayloadSize;
+        flow->receiveBuffer = allocateDataBuffer(window, flow->bufferPayloadSize);
+        setFirstSeqNoOfBuffer(flow->receiveBuffer, flow->lastReceivedSeqNo + 1);
+        if (fecGroupSize > 0) {
+            flow->fec = createFecDecoder(fecGroupSize, fecParityCount,
+                                         flow->bufferPayloadSize, window);
         }
+    }
+
+    DataBuffer receiveBuffer = flow->receiveBuffer;
+    long seqNo = data->seqNo;
+    bool inOrder = seqNo == flow->lastReceivedSeqNo + 1;
+    bool finished = false;
+    DataPacket *dataPacket;
 
-        data->size = bytesRead;
-        totalBytes += bytesRead - sizeof(*data);
-
-        // check if CRC is valid
-        tmpCRC = data->crcSum;
-        data->crcSum = 0;
-        crcValid = true;
-        crcValid = (tmpCRC == crcGoBackNMessageStruct(data));
-
-        DEBUGOUT("#%d, size: %u, CRC: %u\n", data->seqNo, data->size, tmpCRC);
-
-        /* YOUR TASK: (done) */
-        if (crcValid == true && data->seqNo == lastReceivedSeqNo + 1){
-          sendAck(s, data, lastReceivedSeqNo + 2);
-          lastReceivedSeqNo++;
-          goodBytes += data->size - sizeof(*data);
-
-          // Wenn folgender Fall eintritt, wurde die Datei
-          // komplett uebertragen und wir koennen das Programm
-          // beenden
-          if (data->size == sizeof(*data)){
-            fclose(output);
-            printf("Total bytes: %zu\nGood bytes: %zu\n\n", totalBytes, goodBytes);
-            freeGoBackNMessageStruct(data);
-            close(s);
-            free(cliaddr);
-            exit(0);
-          }
-          writeBuffer(output, data);
+    if (inOrder) {
+        finished = deliver(worker, flow, data);
+        ++flow->lastReceivedSeqNo;
+        if (getBufferSize(receiveBuffer) > 0) {
+            // the packet filled the hole at the start of the buffer
+            freeBuffer(receiveBuffer, flow->lastReceivedSeqNo, flow->lastReceivedSeqNo);
         } else {
-          sendAck(s, data, lastReceivedSeqNo + 1);
+            setFirstSeqNoOfBuffer(receiveBuffer, flow->lastReceivedSeqNo + 1);
+        }
+    } else {
+        // NULL for duplicates or packets outside of the window
+        dataPacket = data->size - sizeof(*data) <= flow->bufferPayloadSize
+                     ? storeDataPacketInBuffer(receiveBuffer, seqNo) : NULL;
+        if (dataPacket != NULL) {
+            memcpy(dataPacket->packet, data, data->size);
+        }
+    }
+
+    while (!finished &&
+           (dataPacket = getDataPacketFromBuffer(receiveBuffer,
+                                                 flow->lastReceivedSeqNo + 1)) != NULL) {
+        finished = deliver(worker, flow, dataPacket->packet);
+        ++flow->lastReceivedSeqNo;
+        freeBuffer(receiveBuffer, flow->lastReceivedSeqNo, flow->lastReceivedSeqNo);
+    }
+
+    // an in-order packet that left no gap behind may be acknowledged later
+    acknowledge(worker, flow, seqNo,
+                inOrder && !finished && getBufferSize(receiveBuffer) == 0);
+
+    if (finished) {
+        finish(worker, flow);
+    }
+}
+
+// Feeds an intact data or parity packet to the flow's FEC decoder and
+// receives the packet it rebuilds, if any. Packets beyond the receive window
+// would push groups still needed out of the decoder.
+void recoverPacket(Worker *worker, Flow *flow, const GoBackNMessageStruct *msg) {
+    if (flow->fec == NULL || msg->seqNo > flow->lastReceivedSeqNo + window) {
+        return;
+    }
+    GoBackNMessageStruct *recovered = addToFecDecoder(flow->fec, msg);
+    if (recovered != NULL && isIntact(worker, flow, recovered)) {
+        LOG_DEBUG("FEC: #%" PRId64 " recovered\n", recovered->seqNo);
+        ++flow->recovered;
+        receiveSelective(worker, flow, recovered, true);
+    }
+}
+
+// Handles one received datagram. Returns false if the receiver should stop
+// (empty datagram, ignored by the daemon).
+bool handlePacket(Worker *worker, GoBackNMessageStruct *data, size_t bytesRead,
+                  bool truncated, const struct sockaddr *from, socklen_t fromlen) {
+    bool crcValid = false;
+
+    if (truncated) {
+        LOG_WARNING("Truncated read\n");
+    }
+
+    LOG_DEBUG("SOCKET: %zu bytes received.\n", bytesRead);
+    ++worker->packetsReceived;
+    worker->bytesReceived += bytesRead;
+
+    if (bytesRead == 0) {
+        return daemonMode;
+    }
+    if (bytesRead < sizeof(*data)) {
+        LOG_WARNING("Datagram shorter than header\n");
+        return true;
+    }
+
+    // check if the header matches the datagram and the CRC is valid, a packet
+    // that fails either is treated as corrupt; the slot is left as received
+    crcValid = isValidGoBackNMessage(data, bytesRead) && checkCrcGoBackNMessageStruct(data);
+
+    LOG_DEBUG("#%" PRId64 ", size: %u, CRC: %u\n", data->seqNo, data->size, data->crcSum);
+    TRACE(crcValid ? TRACE_RECEIVE : TRACE_CORRUPT, data->transferId, data->seqNo,
+          bytesRead);
+
+    if (crcValid && data->type == MESSAGE_RESUME) {
+        answerResume(worker, data, from, fromlen);
+        return true;
+    }
+
+    // A flow starts with an intact first packet. A single receiver serves
+    // the first transfer that shows up (all of its streams) and ignores all
+    // others.
+    Flow *flow = findFlow(worker, from, fromlen, data->transferId);
+    if (flow == NULL) {
+        if (crcValid && resume && !daemonMode && data->type == MESSAGE_DATA &&
+            data->seqNo == 0) {
+            takeOverStream(worker, data);
+        }
+        if (!crcValid || data->type != MESSAGE_DATA || data->seqNo != 0 ||
+            (flow = createFlow(worker, from, fromlen, data)) == NULL) {
+            LOG_DEBUG("FLOW: packet #%" PRId64 " of unknown transfer dropped\n",
+                      data->seqNo);
+            return true;
+        }
+    }
+    flow->lastActivity = worker->now;
+    crcValid = crcValid && isIntact(worker, flow, data);
+    if (crcValid && data->type == MESSAGE_VERIFY) {
+        if (flow->finished) {
+            answerVerify(worker, flow, data);
+        }
+        return true;
+    }
+    if (crcValid && data->type == MESSAGE_PARITY) {
+        if (!flow->finished) {
+            recoverPacket(worker, flow, data);
+        }
+        return true;
+    }
+    if (crcValid && data->type != MESSAGE_DATA) {
+        return true;
+    }
+    if (flow->finished) {
+        if (crcValid) {
+            sendAck(worker, flow, mode == MODE_SELECTIVE ? data->seqNo : -1,
+                    flow->lastReceivedSeqNo + 1);
+        }
+        return true;
+    }
+    flow->totalBytes += bytesRead - sizeof(*data);
+
+    ++flow->packets;
+    if (!crcValid) {
+        ++flow->corrupt;
+    } else if (data->seqNo <= flow->lastReceivedSeqNo) {
+        ++flow->duplicates;
+    } else if (data->seqNo > flow->lastReceivedSeqNo + 1) {
+        ++flow->outOfOrder;
+    }
+
+    // with --fec the packets behind a loss are kept until parity rebuilds
+    // it, so Go-Back-N receives like selective repeat (its sender only looks
+    // at seqNoExpected)
+    if (mode == MODE_SELECTIVE || fecGroupSize > 0) {
+        receiveSelective(worker, flow, data, crcValid);
+        if (crcValid && !flow->finished) {
+            recoverPacket(worker, flow, data);
+        }
+        return true;
+    }
+
+    /* YOUR TASK: (done) */
+    if (crcValid == true && data->seqNo == flow->lastReceivedSeqNo + 1){
+      flow->lastReceivedSeqNo++;
+
+      // Wenn folgender Fall eintritt, wurde die Datei
+      // komplett uebertragen und wir koennen das Programm
+      // beenden
+      if (deliver(worker, flow, data)){
+        acknowledge(worker, flow, -1, false);
+        finish(worker, flow);
+        return true;
+      }
+      acknowledge(worker, flow, -1, true);
+    } else {
+      acknowledge(worker, flow, -1, false);
+    }
+    /* END YOUR TASK (done) */
+
+    return true;
+}
+
+// Largest datagram behind the header, parity packets carry a ParityInfo in
+// front of their payload.
+size_t maxDataSize(void) {
+    return maxPayloadSize + (fecGroupSize > 0 ? sizeof(ParityInfo) : 0);
+}
+
+void *runWorker(void *arg) {
+    Worker *worker = (Worker *) arg;
+
+    bool running = true;
+    while (running) {
+
+        // with a timer pending we must not block past its deadline
+        struct timeval wait;
+        bool timerPending = processTimers(worker, &wait);
+        flushAcks(worker);
+        if (worker->done) {
+            break;
+        }
+
+        int count = receiveDatagrams(&worker->io, timerPending ? &wait : NULL);
+        if (count == 0) {
+            continue;
+        }
+
+        now(&worker->now);
+
+        for (int i = 0; running && i < count; ++i) {
+            size_t length;
+            bool truncated;
+            const struct sockaddr *from;
+            socklen_t fromlen;
+            GoBackNMessageStruct *data = (GoBackNMessageStruct *) getDatagram(
+                    &worker->io, i, &length, &truncated, &from, &fromlen);
+
+            running = handlePacket(worker, data, length, truncated, from, fromlen);
+        }
+
+        flushAcks(worker);
+    }
+    return NULL;
+}
+
+// The daemon binds one socket per worker to the same port, the kernel keeps
+// all datagrams of a sender on the same socket.
+bool startWorker(Worker *worker) {
+    memset(worker, 0, sizeof(*worker));
+
+    worker->s = daemonMode ? udp_server_shared(NULL, localPort, NULL)
+                           : udp_server(NULL, localPort, NULL);
+    if (worker->s < 0) {
+        return false;
+    }
+
+    // a whole window of the largest packets may arrive at once
+    udp_set_buffer_size(worker->s,
+                        window * (maxDataSize() + sizeof(GoBackNMessageStruct)));
+
+    size_t slotSize = (sizeof(GoBackNMessageStruct) + maxDataSize() + 7) & ~(size_t) 7;
+    worker->ring = (char *) calloc(batchSize, slotSize);
+    worker->slots = (GoBackNMessageStruct **) calloc(batchSize,
+                                                     sizeof(GoBackNMessageStruct *));
+    for (unsigned i = 0; i < batchSize; ++i) {
+        worker->slots[i] = (GoBackNMessageStruct *) (worker->ring + i * slotSize);
+    }
+    if (!initAsyncIo(&worker->io, ioBackend, worker->s, (void **) worker->slots, batchSize,
+                     slotSize)) {
+        close(worker->s);
+        return false;
+    }
+    worker->ackBatch = allocateDatagramBatch(batchSize);
+    worker->acks = (GoBackNMessageStruct *) calloc(batchSize, sizeof(GoBackNMessageStruct));
+    worker->inflatedSize = maxPayloadSize * MAX_COMPRESSION_RATIO;
+    worker->inflated = (uint8_t *) malloc(worker->inflatedSize);
+    now(&worker->now);
+    timeradd(&worker->now, &statsInterval, &worker->nextStats);
+    worker->nextCheckpoint = worker->now;
+    worker->nextCheckpoint.tv_sec += CHECKPOINT_INTERVAL;
+    return true;
+}
+
+void stopWorker(Worker *worker) {
+    while (worker->flowCount > 0) {
+        Flow *flow = worker->flows[0];
+        if (flow->output != NULL) {
+            checkpointFlow(flow);
+            closeOutputBuffer(flow->output);
+        }
+        removeFlow(worker, flow);
+    }
+    free(worker->flows);
+
+    destroyAsyncIo(&worker->io);
+    free(worker->ring);
+    free(worker->slots);
+    deallocateDatagramBatch(worker->ackBatch);
+    free(worker->acks);
+    free(worker->inflated);
+    close(worker->s);
+}
+
+int main(int argc, char **argv) {
+    initialize(argc, argv);
+
+    if (daemonMode) {
+        struct stat st;
+        if (stat(fileName, &st) < 0 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "%s: not a directory\n", fileName);
+            exit(1);
+        }
+    } else {
+        // open file, with --resume the one an interrupted attempt left behind
+        singleFile = (OutputFile *) calloc(1, sizeof(OutputFile));
+        singleFile->fd = open(fileName, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+        if (singleFile->fd < 0) {
+            perror("open");
+            exit(1);
         }
-        /* END YOUR TASK (done) */
+        if (resume) {
+            checkpointPath(singleFile->checkpoint, sizeof(singleFile->checkpoint), NULL, 0);
+        }
+    }
 
-        freeGoBackNMessageStruct(data);
+    Worker *workers = (Worker *) calloc(threadCount, sizeof(Worker));
+    for (unsigned i = 0; i < threadCount; ++i) {
+        if (!startWorker(&workers[i])) {
+            exit(1);
+        }
+    }
+
+    if (threadCount == 1) {
+        runWorker(&workers[0]);
+    } else {
+        for (unsigned i = 0; i < threadCount; ++i) {
+            if ((errno = pthread_create(&workers[i].thread, NULL, runWorker,
+                                        &workers[i])) != 0) {
+                perror("pthread_create");
+                exit(1);
+            }
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    // a single transfer that was stopped (empty datagram) keeps what it got
+    for (unsigned i = 0; i < threadCount; ++i) {
+        stopWorker(&workers[i]);
+    }
+    free(workers);
+    if (singleFile != NULL) {
+        close(singleFile->fd);
+        free(singleFile);
     }
-    free(cliaddr);
 }
@@ -15,64 +15,295 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <limits.h>
-
-#include <sys/select.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <errno.h>
 
+#include "CRC.h"
+#include "Compression.h"
 #include "DataBuffer.h"
+#include "DatagramBatch.h"
+#include "Fec.h"
+#include "RttEstimator.h"
+#include "CongestionControl.h"
 #include "SocketConnection.h"
-
-#define DEBUG
-#ifdef DEBUG
-#define DEBUGOUT(...) fprintf(stderr, __VA_ARGS__)
-#else
-#define DEBUGOUT(...)
-#endif
+#include "Log.h"
+#include "Trace.h"
+#include "Stats.h"
+#include "PacketPipeline.h"
 
 #define DEFAULT_REMOTE_PORT "4343"
 #define DEFAULT_PAYLOAD_SIZE 1024
-#define MAX_FILE_SIZE 1024
-
-struct timeval timeout;
-unsigned window;
-char *remotePort;
-char *remoteName;
-char *fileName;
-DataBuffer dataBuffer;
-
-long lastAckSeqNo;
-long nextSendSeqNo;
-
-struct timeval timerExpiration;
+#define DEFAULT_BATCH_SIZE 32
+#define DEFAULT_PARALLEL 16
+#define DEFAULT_CHECKSUM_THREADS 1
+#define MIN_PIPELINE_DEPTH 16
+#define MIN_STREAM_SIZE (1024 * 1024)  // smallest byte range worth a stream
+#define MAX_EVENTS 64
+#define TRACE_RECORDS (1 << 16)
+#define DEFAULT_STATS_INTERVAL 1000  // msec
+#define MAX_VERIFY_ATTEMPTS 5  // the receiver may have stopped lingering
+#define NO_ACK_TIMEOUT 30  // seconds without an ACK before a transfer fails
+
+// epoll events are tagged with the transfer's job, its slot and the kind of
+// fd. A slot is reused as soon as its transfer has finished, the job tells
+// events still pending for the old transfer apart.
+typedef enum EventSource {
+    EVENT_SOCKET,
+    EVENT_TIMER,
+    EVENT_PIPELINE
+} EventSource;
+
+#define EVENT_TAG(t, source) \
+    ((uint64_t) ((t)->job - jobs) << 32 | (uint64_t) (t)->slot << 2 | (source))
+
+// With --resume a transfer asks the receiver where to start before it sends
+// data and verifies the checksum of its range afterwards.
+typedef enum TransferPhase {
+    PHASE_RESUME,
+    PHASE_DATA,
+    PHASE_VERIFY,
+    PHASE_DONE
+} TransferPhase;
+
+// A file, or one byte range of it, to send and where to.
+typedef struct Job {
+    char *remoteName;
+    char *remotePort;
+    char *fileName;
+    uint32_t transferId;  // shared by the streams of a file
+    unsigned streamId, streamCount;
+    uint64_t offset, length;  // length UINT64_MAX: up to the end of the file
+} Job;
+
+// State of one transfer, the sender drives up to --parallel of them at once.
+// Each has its own connected socket and a timerfd for the retransmission
+// timer, all times are CLOCK_MONOTONIC.
+typedef struct Transfer {
+    bool active;
+    TransferPhase phase;
+    const Job *job;
+    unsigned slot;
+    int s;
+    int timer;
+    struct timeval armed;  // expiration the timerfd is set to
+    bool blocked;          // send() would block, waiting for EPOLLOUT
+    uint32_t transferId;   // tells this transfer apart at the receiver
+
+    struct timeval timeout;  // current RTO, taken from rttEstimator
+    RttEstimator rttEstimator;
+    CongestionControl congestion;
+    size_t payloadSize;
+    DataBuffer dataBuffer;
+    FILE *input;               // read in the event loop without a pipeline
+    PayloadCompressor compressor;  // with --compress and without a pipeline
+    const char *map;           // with --mmap: the range, from mapOffset on
+    size_t mapLength;
+    uint64_t mapOffset;        // file position of map[0], page aligned
+    uint64_t offset, remaining;  // of the byte range still to be read
+    PacketPipeline pipeline;   // reads and checksums ahead in other threads
+    FecEncoder fec;            // parity of new packets, NULL without --fec
+
+    // control messages of --resume
+    unsigned controlAttempts;
+    struct timeval controlSent;
+    uint64_t resumedBytes;   // of the range, sent by an earlier attempt
+    RangeChecksum checksum;  // of the whole range, read back from the file
+    bool verified;
+
+    // socket I/O statistics
+    size_t packetsSent, bytesSent, acksReceived, socketSyscalls, paritySent;
+    size_t compressedPackets;  // of the packets sent for the first time
+    // protocol statistics, bytesAcked counts payload only
+    size_t retransmissions, timeouts, bytesAcked;
+    size_t lastStatsBytes;  // bytesAcked at the last --stats report
+    struct timeval lastStatsTime;
+
+    long lastAckSeqNo;
+    long nextSendSeqNo;
+    long nextNewSeqNo;  // first seqNo that has never been sent
+    long nextReadSeqNo;
+    long veryLastSeqNo;
+    // after the path MTU shrank the packets built before are sent
+    // fragmented up to this one, -1: DF as chosen at the start
+    long fragmentedSeqNo;
+
+    struct timeval timerExpiration;
+    struct timeval lastAck;  // of the data phase, its start before the first
+} Transfer;
+
+struct timeval initialTimeout;
+unsigned window;  // upper bound for the congestion window
+char *congestionName;
+TransferMode mode;
+unsigned batchSize;
+size_t payloadSize;  // 0: largest payload that fits into the path MTU
+unsigned parallel;   // transfers driven at the same time
+unsigned checksumThreads;  // per transfer, 0: no pipeline
+unsigned streams;          // byte ranges a file is split into
+bool resume;               // continue where an earlier attempt stopped
+unsigned fecGroupSize;     // data packets per parity group, 0: no --fec
+unsigned fecParityCount;
+bool compress;             // compress payloads that shrink
+bool mapFiles;             // send payloads straight from a mapping of the file
+DatagramBatch outgoing;
+
+Job *jobs;
+size_t jobCount, nextJob;
+int epfd;
+bool failed;  // at least one transfer could not be started or verified
+struct timeval nextStats;
 
 void help(int exitCode) {
     fprintf(stderr,
             "GoBackNSender [--timeout|-t msec] [--window|-w count] [--remote|-r "
-            "port] hostname file\n");
+            "port] [--mode|-m gobackn|selective] [--batch|-b count] "
+            "[--cc|-c fixed|aimd|vegas] [--payload|-p bytes|auto] "
+            "[--parallel|-P count] [--checksum-threads|-C count] [--streams|-N count] "
+            "[--resume|-R] [--fec|-F group[:parity]] [--compress|-z] [--mmap|-M] [--verbose|-v] [--trace|-x file] "
+            "[--stats|-S file [--stats-interval|-I msec]] "
+            "hostname file|directory... "
+            "[@hostname[:port] file|directory...]...\n");
 
     exit(exitCode);
 }
 
-void initialize(int argc, char **argv) {
-    timeout.tv_sec = 3;
-    timeout.tv_usec = 0;
+// Differs between transfers started from the same host, even within the
+// same second.
+uint32_t newTransferId(void) {
+    struct timeval wallClock;
+    gettimeofday(&wallClock, NULL);
+    return (uint32_t) wallClock.tv_sec * 1000003u ^ (uint32_t) wallClock.tv_usec ^
+           (uint32_t) getpid() << 16 ^ (uint32_t) (jobCount + 1) * 2654435761u;
+}
 
-    timerExpiration.tv_sec = LONG_MAX;
-    timerExpiration.tv_usec = 0;
+// With --resume a file keeps its transferId across attempts, the receiver
+// finds the checkpoint of an interrupted one by it. A file that has changed
+// since gets another one.
+uint32_t resumableTransferId(const char *fileName, const struct stat *st) {
+    uint32_t crc = 0;
+    crc32(fileName, strlen(fileName), &crc);
+    crc32(&st->st_size, sizeof(st->st_size), &crc);
+    crc32(&st->st_mtime, sizeof(st->st_mtime), &crc);
+    return crc;
+}
+
+// With --streams a large file is split into byte ranges that are sent at the
+// same time, each over its own socket. Ranges are at least MIN_STREAM_SIZE.
+void addJob(char *remoteName, char *remotePort, char *fileName, const struct stat *st) {
+    unsigned count = 1;
+    uint64_t size = 0;
+    if (st != NULL && streams > 1) {
+        size = (uint64_t) st->st_size;
+        uint64_t fitting = size / MIN_STREAM_SIZE;
+        count = fitting < streams ? (fitting > 0 ? (unsigned) fitting : 1) : streams;
+    }
+    uint64_t rangeSize = (size + count - 1) / count;
+    uint32_t transferId = resume && st != NULL ? resumableTransferId(fileName, st)
+                                               : newTransferId();
+
+    jobs = (Job *) realloc(jobs, (jobCount + count) * sizeof(Job));
+    for (unsigned i = 0; i < count; ++i) {
+        Job *job = &jobs[jobCount++];
+        job->remoteName = remoteName;
+        job->remotePort = remotePort;
+        job->fileName = fileName;
+        job->transferId = transferId;
+        job->streamId = i;
+        job->streamCount = count;
+        job->offset = i * rangeSize;
+        job->length = count == 1 ? UINT64_MAX
+                                 : (i + 1 == count ? size - job->offset : rangeSize);
+    }
+}
+
+// A directory stands for the regular files in it, in name order.
+void addJobs(char *remoteName, char *remotePort, char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        addJob(remoteName, remotePort, path, NULL);  // fails when it is started
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        addJob(remoteName, remotePort, path, &st);
+        return;
+    }
+
+    struct dirent **entries;
+    int count = scandir(path, &entries, NULL, alphasort);
+    if (count < 0) {
+        perror(path);
+        exit(1);
+    }
+    for (int i = 0; i < count; ++i) {
+        size_t length = strlen(path) + strlen(entries[i]->d_name) + 2;
+        char *fileName = (char *) malloc(length);
+        snprintf(fileName, length, "%s/%s", path, entries[i]->d_name);
+        if (stat(fileName, &st) == 0 && S_ISREG(st.st_mode)) {
+            addJob(remoteName, remotePort, fileName, &st);
+        } else {
+            free(fileName);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+}
+
+void initialize(int argc, char **argv) {
+    // initial RTO, RFC 6298 (2.1)
+    initialTimeout.tv_sec = 1;
+    initialTimeout.tv_usec = 0;
 
     window = 25;
-    remotePort = DEFAULT_REMOTE_PORT;
+    congestionName = "aimd";
+    mode = MODE_GOBACKN;
+    batchSize = DEFAULT_BATCH_SIZE;
+    payloadSize = 0;
+    parallel = DEFAULT_PARALLEL;
+    checksumThreads = DEFAULT_CHECKSUM_THREADS;
+    streams = 1;
+    resume = false;
+    fecGroupSize = 0;
+    fecParityCount = 0;
+    compress = false;
+    mapFiles = false;
+    char *remotePort = DEFAULT_REMOTE_PORT;
+    char *statsName = NULL;
+    unsigned statsIntervalMs = DEFAULT_STATS_INTERVAL;
 
     while (1) {
-        static struct option long_options[] = {{"timeout", 1, NULL, 't'},
-                                               {"window",  1, NULL, 'w'},
-                                               {"remote",  1, NULL, 'r'},
-                                               {"help",    0, NULL, 'h'},
-                                               {0,         0, 0,    0}};
-
-        int c = getopt_long(argc, argv, "t:w:r:h", long_options, NULL);
+        static struct option long_options[] = {{"timeout",          1, NULL, 't'},
+                                               {"window",           1, NULL, 'w'},
+                                               {"remote",           1, NULL, 'r'},
+                                               {"mode",             1, NULL, 'm'},
+                                               {"batch",            1, NULL, 'b'},
+                                               {"cc",               1, NULL, 'c'},
+                                               {"payload",          1, NULL, 'p'},
+                                               {"parallel",         1, NULL, 'P'},
+                                               {"checksum-threads", 1, NULL, 'C'},
+                                               {"streams",          1, NULL, 'N'},
+                                               {"resume",           0, NULL, 'R'},
+                                               {"fec",              1, NULL, 'F'},
+                                               {"compress",         0, NULL, 'z'},
+                                               {"mmap",             0, NULL, 'M'},
+                                               {"verbose",          0, NULL, 'v'},
+                                               {"trace",            1, NULL, 'x'},
+                                               {"stats",            1, NULL, 'S'},
+                                               {"stats-interval",   1, NULL, 'I'},
+                                               {"help",             0, NULL, 'h'},
+                                               {0,                  0, 0,    0}};
+
+        int c = getopt_long(argc, argv, "t:w:r:m:b:c:p:P:C:N:RF:zMvx:S:I:h", long_options, NULL);
         if (c == -1) break;
 
         int retval;
@@ -81,8 +312,8 @@ void initialize(int argc, char **argv) {
                 unsigned msec;
                 retval = sscanf(optarg, "%u", &msec);
                 if (retval < 1) help(1);
-                timeout.tv_sec = msec / 1000;
-                timeout.tv_usec = (msec % 1000) * 1000;
+                initialTimeout.tv_sec = msec / 1000;
+                initialTimeout.tv_usec = (msec % 1000) * 1000;
             }
                 break;
 
@@ -95,6 +326,80 @@ void initialize(int argc, char **argv) {
                 remotePort = optarg;
                 break;
 
+            case 'm':
+                if (!parseTransferMode(optarg, &mode)) help(1);
+                break;
+
+            case 'b':
+                retval = sscanf(optarg, "%u", &batchSize);
+                if (retval < 1) help(1);
+                break;
+
+            case 'c':
+                congestionName = optarg;
+                break;
+
+            case 'p':
+                if (strcmp(optarg, "auto") == 0) {
+                    payloadSize = 0;
+                    break;
+                }
+                retval = sscanf(optarg, "%zu", &payloadSize);
+                if (retval < 1 || payloadSize == 0 ||
+                    payloadSize > MAX_PAYLOAD_SIZE) help(1);
+                break;
+
+            case 'P':
+                retval = sscanf(optarg, "%u", &parallel);
+                if (retval < 1 || parallel == 0) help(1);
+                break;
+
+            case 'C':
+                retval = sscanf(optarg, "%u", &checksumThreads);
+                if (retval < 1) help(1);
+                break;
+
+            case 'N':
+                retval = sscanf(optarg, "%u", &streams);
+                if (retval < 1 || streams == 0 || streams > UINT16_MAX) help(1);
+                break;
+
+            case 'R':
+                resume = true;
+                break;
+
+            case 'F':
+                if (!parseFecSpec(optarg, &fecGroupSize, &fecParityCount)) help(1);
+                break;
+
+            case 'z':
+                compress = true;
+                break;
+
+            case 'M':
+                mapFiles = true;
+                break;
+
+            case 'v':
+                ++logLevel;
+                break;
+
+            case 'x':
+                if (!openTrace(optarg, TRACE_RECORDS)) {
+                    perror(optarg);
+                    exit(1);
+                }
+                break;
+
+            case 'S':
+                statsName = optarg;
+                break;
+
+            case 'I':
+                retval = sscanf(optarg, "%u", &statsIntervalMs);
+                if (retval < 1 || statsIntervalMs == 0) help(1);
+                break;
+
             case 'h':
                 help(0);
                 break;
@@ -108,246 +413,1141 @@ void initialize(int argc, char **argv) {
         }
     }
 
-    if (argc < optind + 2 || window <= 0) help(1);
-
-    remoteName = argv[optind];
-    fileName = argv[optind + 1];
+    if (argc < optind + 2 || window <= 0 || batchSize <= 0) help(1);
+    // compressed payloads are not in the file
+    if (compress && mapFiles) help(1);
+    // the streams of a file run at the same time
+    if (parallel < streams) parallel = streams;
+    if (statsName != NULL && !openStats(statsName, statsIntervalMs)) {
+        perror(statsName);
+        exit(1);
+    }
+    CongestionControl probe;
+    if (!initCongestionControl(&probe, congestionName, window)) help(1);
+
+    // hostname file... [@hostname[:port] file...]...
+    char *remoteName = argv[optind];
+    char *port = remotePort;
+    for (int i = optind + 1; i < argc; ++i) {
+        if (argv[i][0] == '@') {
+            remoteName = argv[i] + 1;
+            port = remotePort;
+            char *colon = strrchr(remoteName, ':');
+            if (colon != NULL && strchr(remoteName, ':') == colon) {
+                *colon = '\0';
+                port = colon + 1;
+            }
+        } else {
+            addJobs(remoteName, port, argv[i]);
+        }
+    }
+    if (jobCount == 0) help(1);
 
-    dataBuffer = allocateDataBuffer(MAX_FILE_SIZE);
+    outgoing = allocateDatagramBatch(batchSize);
+}
 
-    lastAckSeqNo = nextSendSeqNo = 0;
+// All deadlines are taken from the monotonic clock, wall clock jumps must
+// neither fire nor stall the retransmission timers.
+void now(struct timeval *tv) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        perror("clock_gettime");
+        exit(1);
+    }
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
 }
 
-bool readIntoBuffer(FILE *file, long seqNo) {
-    DataPacket *dataPacket = (DataPacket *) malloc(sizeof(DataPacket));
+bool readIntoBuffer(Transfer *t, long seqNo) {
+    DataPacket *dataPacket = appendDataPacketToBuffer(t->dataBuffer);
+    GoBackNMessageStruct *packet = dataPacket->packet;
+
+    initGoBackNMessageStruct(packet, MESSAGE_DATA);
+    packet->seqNo = seqNo;
+    packet->seqNoExpected = 0;
+    packet->payloadSize = t->payloadSize;  // announced to the receiver
+    packet->transferId = t->transferId;
+    packet->streamId = t->job->streamId;
+    packet->streamCount = t->job->streamCount;
+    packet->offset = t->offset;
+    packet->crcSum = 0;
+    timerclear(&dataPacket->sent);
+    dataPacket->acked = false;
+    dataPacket->retransmitted = false;
+    dataPacket->payload = NULL;
+
+    if (t->map != NULL) {
+        // the CRC is taken over the mapped pages, they are read only here
+        size_t count = t->remaining < t->payloadSize ? (size_t) t->remaining : t->payloadSize;
+        dataPacket->payload = t->map + (t->offset - t->mapOffset);
+        packet->size = count + sizeof(GoBackNMessageStruct);
+        uint32_t crc = 0;
+        crc32(packet, sizeof(GoBackNMessageStruct), &crc);
+        crc32(dataPacket->payload, count, &crc);
+        packet->crcSum = crc;
+        t->offset += count;
+        t->remaining -= count;
+        return count > 0;
+    }
 
-    dataPacket->packet = (GoBackNMessageStruct *) malloc(
-            sizeof(GoBackNMessageStruct) + DEFAULT_PAYLOAD_SIZE);
-    dataPacket->packet->seqNo = seqNo;
-    dataPacket->packet->seqNoExpected = -1;
-    dataPacket->packet->crcSum = 0;
+    if (t->compressor != NULL) {
+        size_t bytesRead;
+        bool compressed;
+        size_t size = compressPayload(t->compressor, packet->data, &bytesRead, &compressed);
+        LOG_DEBUG("FILE: %zu bytes read, %zu to send\n", bytesRead, size);
+        packet->flags = compressed ? FLAG_COMPRESSED : 0;
+        packet->size = size + sizeof(GoBackNMessageStruct);
+        t->offset += bytesRead;
+        t->remaining -= bytesRead;
+        packet->crcSum = crcGoBackNMessageStruct(packet);
+        return bytesRead > 0;
+    }
 
-    size_t bytesRead =
-            fread(dataPacket->packet->data, 1, DEFAULT_PAYLOAD_SIZE, file);
-    DEBUGOUT("FILE: %zu bytes read\n", bytesRead);
-    dataPacket->packet->size = bytesRead + sizeof(GoBackNMessageStruct);
+    size_t count = t->remaining < t->payloadSize ? (size_t) t->remaining : t->payloadSize;
+    size_t bytesRead = count > 0 ? fread(packet->data, 1, count, t->input) : 0;
+    LOG_DEBUG("FILE: %zu bytes read\n", bytesRead);
+    packet->size = bytesRead + sizeof(GoBackNMessageStruct);
+    t->offset += bytesRead;
+    t->remaining -= bytesRead;
 
-    dataPacket->packet->crcSum = crcGoBackNMessageStruct(dataPacket->packet);
+    packet->crcSum = crcGoBackNMessageStruct(packet);
 
-    if (bytesRead < DEFAULT_PAYLOAD_SIZE) {
-        if (ferror(file)) {
+    if (bytesRead < count || count == 0) {
+        if (ferror(t->input)) {
             perror("fread");
             exit(1);
         }
         if (bytesRead == 0) {
-            putDataPacketIntoBuffer(dataBuffer, dataPacket);
             return false;
         }
     }
 
-    putDataPacketIntoBuffer(dataBuffer, dataPacket);
     return true;
 }
 
-long readFileIntoBuffer() {
-    long seqNo = 0;
+// Maps the job's byte range for --mmap, the input is not read any more then.
+// Pages are read ahead sequentially as the packets are sent. Files that
+// cannot be mapped (empty, not regular) are read as usual. A file that
+// shrinks while it is mapped ends the sender with SIGBUS.
+void mapInput(Transfer *t) {
+    const Job *job = t->job;
+    int fd = fileno(t->input);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        (uint64_t) st.st_size <= job->offset) {
+        return;
+    }
+    uint64_t end = (uint64_t) st.st_size;
+    if (job->length != UINT64_MAX && job->offset + job->length < end) {
+        end = job->offset + job->length;
+    }
 
-    FILE *input = fopen(fileName, "rb");
-    if (input == NULL) {
-        perror("fopen");
-        exit(1);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    t->mapOffset = job->offset & ~((uint64_t) pageSize - 1);
+    t->mapLength = (size_t) (end - t->mapOffset);
+    void *map = mmap(NULL, t->mapLength, PROT_READ, MAP_SHARED, fd, (off_t) t->mapOffset);
+    if (map == MAP_FAILED) {
+        LOG_WARNING("%s: mmap: %s, reading it instead\n", job->fileName, strerror(errno));
+        return;
     }
+    if (madvise(map, t->mapLength, MADV_SEQUENTIAL) < 0) {
+        LOG_DEBUG("madvise: %s\n", strerror(errno));
+    }
+    t->map = (const char *) map;
+    fclose(t->input);
+    t->input = NULL;
+}
+
+// Without --payload every packet is made as large as the path MTU allows, the
+// DF bit keeps the kernel from fragmenting them. The data buffer depends on
+// the payload size and is allocated here. With --fec the parity packets
+// carry a ParityInfo in front of the payload, which has to fit as well.
+void choosePayloadSize(Transfer *t) {
+    int probed = udp_probe_payload(t->s);
+    size_t parityInfo = fecGroupSize > 0 ? sizeof(ParityInfo) : 0;
+    size_t overhead = sizeof(GoBackNMessageStruct) + parityInfo;
+
+    t->payloadSize = payloadSize;
+    if (t->payloadSize == 0) {
+        if (probed > (int) overhead) {
+            t->payloadSize = probed - overhead;
+        } else {
+            t->payloadSize = DEFAULT_PAYLOAD_SIZE;
+        }
+    }
+    if (t->payloadSize > MAX_PAYLOAD_SIZE - parityInfo) {
+        t->payloadSize = MAX_PAYLOAD_SIZE - parityInfo;
+    }
+    if (probed < 0 || t->payloadSize + overhead > (size_t) probed) {
+        // explicitly larger than the path MTU (or unknown), fragment
+        udp_allow_fragmentation(t->s);
+    }
+    LOG_INFO("payload size: %zu (path MTU payload: %d)\n", t->payloadSize, probed);
+
+    // the buffer only has to hold the packets of the current window,
+    // the file is read ahead as the receiver acknowledges packets; mapped
+    // payloads stay in the mapping, pipelined ones in the pipeline's ring
+    bool payloadElsewhere = t->map != NULL || checksumThreads > 0;
+    t->dataBuffer = allocateDataBuffer(window, payloadElsewhere ? 0 : t->payloadSize);
 
-    while (readIntoBuffer(input, seqNo)) ++seqNo;
-    fclose(input);
+    // room for a whole window of large packets in the kernel
+    udp_set_buffer_size(t->s, window * (t->payloadSize + sizeof(GoBackNMessageStruct)));
 
-    return seqNo;
+    if (fecGroupSize > 0) {
+        t->fec = createFecEncoder(fecGroupSize, fecParityCount, t->payloadSize);
+    }
 }
 
-int main(int argc, char **argv) {
-    // parse command line arguments
-    initialize(argc, argv);
+// The packets of the data buffer stay in the pipeline's ring until they are
+// acknowledged, it reads up to a window more ahead.
+size_t pipelineDepth(void) {
+    return window + (window > MIN_PIPELINE_DEPTH ? window : MIN_PIPELINE_DEPTH);
+}
 
-    // read file
-    long veryLastSeqNo = readFileIntoBuffer();
-    DEBUGOUT("veryLastSeqNo: %ld\n", veryLastSeqNo);
+// The path MTU shrank below our packets (EMSGSIZE). New packets are made as
+// large as the path MTU the kernel has learned allows, the ones already
+// read (or read ahead by the pipeline) are sent fragmented until they are
+// acknowledged.
+void handlePathMtuDecrease(Transfer *t) {
+    int probed = udp_path_payload(t->s);
+    size_t overhead = sizeof(GoBackNMessageStruct) + (fecGroupSize > 0 ? sizeof(ParityInfo) : 0);
+    if (probed > (int) overhead && (size_t) probed - overhead < t->payloadSize) {
+        t->payloadSize = (size_t) probed - overhead;
+        if (t->pipeline != NULL) {
+            setPipelinePayloadSize(t->pipeline, t->payloadSize);
+        }
+        if (t->compressor != NULL) {
+            setCompressorPayloadSize(t->compressor, t->payloadSize);
+        }
+    }
+    LOG_WARNING("Path MTU dropped, payload size now %zu\n", t->payloadSize);
+
+    t->fragmentedSeqNo = t->nextReadSeqNo + (t->pipeline != NULL ? (long) pipelineDepth() : 0);
+    udp_allow_fragmentation(t->s);
+}
 
-    // prepare channel to receiver
-    // we use "connect()" here because we have only one receiver
-    // despite using UDP, you will have to use send()/recv() later!
-    int s = udp_connect(remoteName, remotePort);
-    if (s < 0) {
+// Takes a packet the pipeline has read and checksummed already. Only the
+// header is copied, the payload is sent from the ring until the packet is
+// acknowledged. Returns false for the empty last packet, like
+// readIntoBuffer().
+bool takeFromPipeline(Transfer *t, const GoBackNMessageStruct *packet) {
+    DataPacket *dataPacket = appendDataPacketToBuffer(t->dataBuffer);
+    *dataPacket->packet = *packet;
+    dataPacket->payload = packet->data;
+    timerclear(&dataPacket->sent);
+    dataPacket->acked = false;
+    dataPacket->retransmitted = false;
+    return packet->size > sizeof(GoBackNMessageStruct);
+}
+
+// Reads ahead until the buffer holds a whole window or the end of the file
+// has been reached. veryLastSeqNo stays LONG_MAX until the (empty) last
+// packet has been read. With a pipeline only the packets that are ready are
+// taken, its eventfd reports the next ones.
+void fillBuffer(Transfer *t) {
+    while (t->veryLastSeqNo == LONG_MAX && getBufferSize(t->dataBuffer) < window) {
+        bool more;
+        if (t->pipeline != NULL) {
+            const GoBackNMessageStruct *packet = peekPipelinePacket(t->pipeline);
+            if (packet == NULL) {
+                break;
+            }
+            more = takeFromPipeline(t, packet);
+            takePipelinePacket(t->pipeline);
+        } else {
+            more = readIntoBuffer(t, t->nextReadSeqNo);
+        }
+
+        if (!more) {
+            t->veryLastSeqNo = t->nextReadSeqNo;
+            LOG_DEBUG("veryLastSeqNo: %ld\n", t->veryLastSeqNo);
+            if (t->input != NULL) {
+                fclose(t->input);
+                t->input = NULL;
+            }
+        }
+        ++t->nextReadSeqNo;
+    }
+}
+
+void handlePipelineEvent(Transfer *t) {
+    uint64_t count;
+    if (read(getPipelineEventFd(t->pipeline), &count, sizeof(count)) < 0 &&
+        errno != EAGAIN) {
+        perror("read");
         exit(1);
     }
+    fillBuffer(t);
+}
 
-    // wir sind fertig wenn die seqNo vom letzten Paket acknowledged wurde
-    while (lastAckSeqNo <= veryLastSeqNo) {
-        DEBUGOUT("nextSendSeqNo: %ld, lastAckSeqNo: %ld\n", nextSendSeqNo,
-                 lastAckSeqNo);
+// Takes an RTT sample from a newly acknowledged packet. Packets that were
+// sent more than once are ignored (Karn's rule), the ACK could belong to any
+// of the transmissions, but still undo the backoff as they show progress.
+// Returns the sample in microseconds or -1.
+long sampleRtt(Transfer *t, const DataPacket *data) {
+    if (data == NULL || data->retransmitted || !timerisset(&data->sent)) {
+        if (t->rttEstimator.backoff > 0) {
+            resetRtoBackoff(&t->rttEstimator);
+            getRto(&t->rttEstimator, &t->timeout);
+        }
+        return -1;
+    }
 
-        fd_set readfds, writefds;
-        FD_ZERO(&readfds);
-        FD_ZERO(&writefds);
-        FD_SET(s, &readfds);
+    struct timeval currentTime, rtt;
+    now(&currentTime);
+    timersub(&currentTime, &data->sent, &rtt);
 
-        if (nextSendSeqNo <= veryLastSeqNo &&
-            nextSendSeqNo <= getLastSeqNoOfBuffer(dataBuffer) &&
-            nextSendSeqNo < lastAckSeqNo + window) {
-            FD_SET(s, &writefds);
+    addRttSample(&t->rttEstimator, &rtt);
+    getRto(&t->rttEstimator, &t->timeout);
+    LOG_DEBUG("RTT: %ld us, SRTT: %ld us, RTTVAR: %ld us, RTO: %ld us\n",
+              rtt.tv_sec * 1000000L + rtt.tv_usec, t->rttEstimator.srtt,
+              t->rttEstimator.rttvar, t->rttEstimator.rto);
+    return rtt.tv_sec * 1000000L + rtt.tv_usec;
+}
+
+// Counts the payload of the packets up to lastSeqNo before they are freed.
+void countAcked(Transfer *t, long lastSeqNo) {
+    for (long seqNo = getFirstSeqNoOfBuffer(t->dataBuffer); seqNo <= lastSeqNo; ++seqNo) {
+        t->bytesAcked += getDataPacketFromBuffer(t->dataBuffer, seqNo)->packet->size -
+                         sizeof(GoBackNMessageStruct);
+    }
+}
+
+// Frees the packets below lastAckSeqNo, pipelined ones in the pipeline's
+// ring as well.
+void freeAcked(Transfer *t) {
+    long first = getFirstSeqNoOfBuffer(t->dataBuffer);
+    freeBuffer(t->dataBuffer, first, t->lastAckSeqNo - 1);
+    if (t->pipeline != NULL) {
+        releasePipelinePackets(t->pipeline, (size_t) (t->lastAckSeqNo - first));
+    }
+}
+
+// Exponential backoff, the RTO is reset by the next valid RTT sample.
+void backoff(Transfer *t) {
+    backoffRto(&t->rttEstimator);
+    getRto(&t->rttEstimator, &t->timeout);
+    LOG_INFO("RTO backed off to %ld us\n", t->rttEstimator.rto);
+}
+
+// The timer expires with the earliest deadline of all packets that were sent
+// but neither cumulatively nor selectively acknowledged.
+void updateTimer(Transfer *t) {
+    if (!getNextPacketTimer(t->dataBuffer, &t->timerExpiration)) {
+        t->timerExpiration.tv_sec = LONG_MAX;
+        t->timerExpiration.tv_usec = 0;
+    }
+}
+
+void handleSelectiveAck(Transfer *t, GoBackNMessageStruct *ack) {
+    unsigned newlyAcked = 0;
+    long rtt = -1;
+
+    DataPacket *data = getDataPacketFromBuffer(t->dataBuffer, ack->seqNo);
+    if (data != NULL && !data->acked) {
+        data->acked = true;
+        cancelPacketTimer(t->dataBuffer, ack->seqNo);
+        rtt = sampleRtt(t, data);
+        ++newlyAcked;
+    }
+
+    if (ack->seqNoExpected > t->lastAckSeqNo) {
+        if (ack->seqNo < 0) {
+            rtt = sampleRtt(t, getDataPacketFromBuffer(t->dataBuffer,
+                                                       ack->seqNoExpected - 1));
+        }
+        // packets covered by the cumulative ACK only
+        for (long seqNo = t->lastAckSeqNo; seqNo < ack->seqNoExpected; ++seqNo) {
+            if (!getDataPacketFromBuffer(t->dataBuffer, seqNo)->acked) {
+                ++newlyAcked;
+            }
         }
+        t->lastAckSeqNo = ack->seqNoExpected;
+        countAcked(t, t->lastAckSeqNo - 1);
+        freeAcked(t);
+        fillBuffer(t);
+    }
+
+    if (newlyAcked > 0) {
+        congestionOnAck(&t->congestion, newlyAcked, rtt);
+    }
+    updateTimer(t);
+}
 
-        struct timeval selectTimeout, currentTime;
-        if (gettimeofday(&currentTime, NULL) < 0) {
-            perror("gettimeofday");
+void handleGoBackNAck(Transfer *t, GoBackNMessageStruct *ack) {
+    /* YOUR TASK: (done) */
+    // nur wenn valid und neu wird das ack weiter behandelt
+    if (ack->seqNoExpected > t->lastAckSeqNo){
+      long rtt = sampleRtt(t, getDataPacketFromBuffer(t->dataBuffer, ack->seqNoExpected - 1));
+      congestionOnAck(&t->congestion, ack->seqNoExpected - t->lastAckSeqNo, rtt);
+      LOG_DEBUG("cwnd: %.2f, ssthresh: %.2f\n", t->congestion.cwnd,
+                t->congestion.ssthresh);
+      t->lastAckSeqNo = (ack->seqNoExpected);
+      if (t->nextSendSeqNo < t->lastAckSeqNo){
+        t->nextSendSeqNo = t->lastAckSeqNo;
+      }
+      // freeBuffer() cancels the timers of the acknowledged packets, the
+      // timer now runs for the oldest packet still outstanding
+      countAcked(t, t->lastAckSeqNo - 1);
+      freeAcked(t);
+      fillBuffer(t);
+      updateTimer(t);
+    }
+    /* END YOUR TASK (done) */
+}
+
+void watch(int fd, int op, uint32_t events, uint64_t tag) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = tag;
+    if (epoll_ctl(epfd, op, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+// Starts reading and sending the range from offset on, the start of the
+// job's range unless an earlier attempt got further (--resume).
+void startData(Transfer *t, uint64_t offset) {
+    const Job *job = t->job;
+    t->phase = PHASE_DATA;
+    now(&t->lastAck);
+    t->resumedBytes = offset - job->offset;
+    t->offset = offset;
+    t->remaining = job->length == UINT64_MAX ? UINT64_MAX : job->length - t->resumedBytes;
+    if (t->map != NULL) {
+        uint64_t end = t->mapOffset + t->mapLength;
+        t->remaining = offset < end ? end - offset : 0;
+    } else if (offset > 0 && fseeko(t->input, (off_t) offset, SEEK_SET) < 0) {
+        perror(job->fileName);
+        exit(1);
+    }
+    t->timerExpiration.tv_sec = LONG_MAX;
+
+    // the pipeline runs up to a window ahead of the data buffer
+    if (checksumThreads > 0 && t->map == NULL) {
+        size_t depth = pipelineDepth();
+        GoBackNMessageStruct header = {0};
+        initGoBackNMessageStruct(&header, MESSAGE_DATA);
+        header.transferId = t->transferId;
+        header.streamId = job->streamId;
+        header.streamCount = job->streamCount;
+        t->pipeline = startPacketPipeline(t->input, t->offset, t->remaining,
+                                          t->payloadSize, &header, depth,
+                                          checksumThreads, compress);
+        if (t->pipeline == NULL) {
+            perror("startPacketPipeline");
             exit(1);
         }
-        DEBUGOUT("current time: %ld,%ld\n", currentTime.tv_sec,
-                 currentTime.tv_usec);
-        timersub(&timerExpiration, &currentTime, &selectTimeout);
+        t->input = NULL;
+        watch(getPipelineEventFd(t->pipeline), EPOLL_CTL_ADD, EPOLLIN,
+              EVENT_TAG(t, EVENT_PIPELINE));
+    } else if (compress) {
+        t->compressor = createPayloadCompressor(t->input, t->remaining, t->payloadSize);
+    }
+
+    // read the first window
+    fillBuffer(t);
+}
 
-        if (selectTimeout.tv_sec < 0 || selectTimeout.tv_usec < 0) {
-            fprintf(stderr, "WARNING: Timeout was negative (%ld,%ld)\n",
-                    selectTimeout.tv_sec, selectTimeout.tv_usec);
-            selectTimeout.tv_sec = selectTimeout.tv_usec = 0;
+// Sends the control message of the current phase. It is repeated when the
+// timer expires, with the RTO backed off like for data packets.
+void sendControl(Transfer *t) {
+    GoBackNMessageStruct message = {0};
+    initGoBackNMessageStruct(&message, t->phase == PHASE_RESUME ? MESSAGE_RESUME
+                                                                : MESSAGE_VERIFY);
+    message.size = sizeof(message);
+    message.payloadSize = t->payloadSize;
+    message.transferId = t->transferId;
+    message.streamId = t->job->streamId;
+    message.streamCount = t->job->streamCount;
+    message.offset = t->job->offset;
+    message.crcSum = crcGoBackNMessageStruct(&message);
+
+    if (send(t->s, &message, message.size, MSG_DONTWAIT) < 0 && errno != EAGAIN &&
+        errno != ECONNREFUSED) {
+        perror("send");
+        exit(1);
+    }
+    LOG_DEBUG("SOCKET: control message %u sent\n", message.type);
+    ++t->socketSyscalls;
+    ++t->controlAttempts;
+
+    now(&t->controlSent);
+    timeradd(&t->controlSent, &t->timeout, &t->timerExpiration);
+}
+
+// The answer to the first attempt is an RTT sample like an ACK.
+void sampleControlRtt(Transfer *t) {
+    DataPacket control = {0};
+    control.sent = t->controlSent;
+    control.retransmitted = t->controlAttempts > 1;
+    sampleRtt(t, &control);
+}
+
+void handleResumeAnswer(Transfer *t, const GoBackNMessageStruct *answer) {
+    if (t->phase != PHASE_RESUME) {
+        return;
+    }
+    sampleControlRtt(t);
+
+    uint64_t offset = answer->offset;
+    if (offset < t->job->offset ||
+        (t->job->length != UINT64_MAX && offset > t->job->offset + t->job->length)) {
+        LOG_WARNING("Resume position %" PRIu64 " outside of the range, starting over\n",
+                    offset);
+        offset = t->job->offset;
+    }
+    if (offset > t->job->offset) {
+        LOG_INFO("%s: resuming at %" PRIu64 "\n", t->job->fileName, offset);
+    }
+    t->controlAttempts = 0;
+    startData(t, offset);
+}
+
+// The whole range is acknowledged. Its checksum is read back from the file,
+// including the part an earlier attempt sent, and compared with the
+// receiver's.
+void startVerify(Transfer *t) {
+    t->phase = PHASE_DONE;
+    int fd = open(t->job->fileName, O_RDONLY);
+    if (fd < 0) {
+        perror(t->job->fileName);
+        failed = true;
+        return;
+    }
+    uint32_t crc = 0;
+    int64_t covered = crc32File(fd, t->job->offset, t->job->length, &crc);
+    close(fd);
+    if (covered < 0) {
+        perror(t->job->fileName);
+        failed = true;
+        return;
+    }
+    t->checksum.length = (uint64_t) covered;
+    t->checksum.crc = crc;
+
+    t->phase = PHASE_VERIFY;
+    sendControl(t);
+}
+
+void handleVerifyAnswer(Transfer *t, const RangeChecksum *checksum) {
+    if (t->phase != PHASE_VERIFY) {
+        return;
+    }
+    sampleControlRtt(t);
+
+    t->verified = checksum->length == t->checksum.length &&
+                  checksum->crc == t->checksum.crc;
+    if (!t->verified) {
+        fprintf(stderr, "%s: checksum mismatch, receiver has %" PRIu64
+                        " bytes (CRC %08" PRIx32 "), expected %" PRIu64 " (CRC %08" PRIx32 ")\n",
+                t->job->fileName, checksum->length, checksum->crc, t->checksum.length,
+                t->checksum.crc);
+        failed = true;
+    }
+    t->phase = PHASE_DONE;
+}
+
+// The receiver may not be up yet, the resume question is repeated until it
+// answers like data packets would be. The checksum is only asked for a few
+// times, a receiver that has stopped lingering does not answer any more.
+void handleControlTimeout(Transfer *t, const struct timeval *currentTime) {
+    if (timercmp(currentTime, &t->timerExpiration, <)) {
+        return;  // fired early, armTimer() sets it again
+    }
+    ++t->timeouts;
+    backoff(t);
+    if (t->phase == PHASE_VERIFY && t->controlAttempts >= MAX_VERIFY_ATTEMPTS) {
+        fprintf(stderr, "%s: the receiver did not answer the checksum request\n",
+                t->job->fileName);
+        failed = true;
+        t->phase = PHASE_DONE;
+        return;
+    }
+    sendControl(t);
+}
+
+void receiveAck(Transfer *t) {
+    bool crcValid;
+    int bytesRead;
+
+    // the answer to MESSAGE_VERIFY carries a checksum
+    struct {
+        GoBackNMessageStruct header;
+        RangeChecksum checksum;
+    } __attribute__((packed)) message = {0};
+    GoBackNMessageStruct *ack = &message.header;
+    if ((bytesRead = recv(t->s, &message, sizeof(message), MSG_DONTWAIT)) < 0) {
+        // ICMP port unreachable for an earlier datagram, e.g. the
+        // receiver is not listening (yet), the packets time out
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
         }
+        if (errno != ECONNREFUSED) {
+            perror("recv");
+            exit(1);
+        }
+        bytesRead = 0;
+    }
+    LOG_DEBUG("SOCKET: %d bytes received\n", bytesRead);
+    ++t->socketSyscalls;
+    ++t->acksReceived;
+
+    crcValid = isValidGoBackNMessage(ack, (size_t) bytesRead) &&
+               checkCrcGoBackNMessageStruct(ack) && ack->transferId == t->transferId;
+    if (crcValid) {
+        TRACE(TRACE_ACK, t->transferId, ack->seqNo, ack->seqNoExpected);
+    }
+
+    if (crcValid == true && ack->type == MESSAGE_RESUME) {
+        handleResumeAnswer(t, ack);
+        return;
+    }
+    if (crcValid == true && ack->type == MESSAGE_VERIFY) {
+        if (bytesRead == sizeof(message)) {
+            handleVerifyAnswer(t, &message.checksum);
+        }
+        return;
+    }
+    if (crcValid == false || ack->type != MESSAGE_ACK || t->phase != PHASE_DATA) {
+        return;
+    }
+    now(&t->lastAck);
+    // nothing beyond what has been sent can be acknowledged
+    if (ack->seqNoExpected > t->nextNewSeqNo || ack->seqNo >= t->nextNewSeqNo) {
+        LOG_WARNING("ACK #%" PRId64 "/%" PRId64 " for packets never sent dropped\n",
+                    ack->seqNo, ack->seqNoExpected);
+        return;
+    }
 
-        if (select(s + 1, &readfds, &writefds, NULL, &selectTimeout) < 0) {
-            perror("select");
+    if (crcValid == true && mode == MODE_SELECTIVE) {
+        handleSelectiveAck(t, ack);
+    }
+    if (crcValid == true && mode == MODE_GOBACKN) {
+        handleGoBackNAck(t, ack);
+    }
+
+    // the packets that did not fit the smaller path MTU are through, new
+    // ones are sent with DF again
+    if (t->fragmentedSeqNo >= 0 && t->lastAckSeqNo > t->fragmentedSeqNo) {
+        t->fragmentedSeqNo = -1;
+        udp_probe_payload(t->s);
+    }
+}
+
+// Selective repeat: only the packets whose own timer expired are sent again,
+// starting with seqNo.
+// A mapped payload (--mmap) is gathered behind the header by the kernel.
+bool queueDataPacket(const DataPacket *data) {
+    if (data->payload == NULL) {
+        return addToBatch(outgoing, data->packet, data->packet->size, NULL, 0);
+    }
+    return addPartsToBatch(outgoing, data->packet, sizeof(GoBackNMessageStruct),
+                           data->payload, data->packet->size - sizeof(GoBackNMessageStruct),
+                           NULL, 0);
+}
+
+ssize_t sendDataPacket(Transfer *t, const DataPacket *data) {
+    if (data->payload == NULL) {
+        return send(t->s, data->packet, data->packet->size, MSG_DONTWAIT);
+    }
+    struct iovec iov[2] = {
+            {data->packet, sizeof(GoBackNMessageStruct)},
+            {(void *) data->payload, data->packet->size - sizeof(GoBackNMessageStruct)}};
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    return sendmsg(t->s, &msg, MSG_DONTWAIT);
+}
+
+void retransmitExpired(Transfer *t, long seqNo, const struct timeval *currentTime) {
+    static const struct timeval expired = {0, 0};
+
+    backoff(t);
+    congestionOnTimeout(&t->congestion);
+
+    for (; seqNo >= 0; seqNo = popExpiredPacketTimer(t->dataBuffer, currentTime)) {
+        DataPacket *data = getDataPacketFromBuffer(t->dataBuffer, seqNo);
+
+        int retval = (int) sendDataPacket(t, data);
+        if (retval < 0) {
+            if (errno == EMSGSIZE)
+                handlePathMtuDecrease(t);
+            if (errno == EAGAIN || errno == ECONNREFUSED || errno == EMSGSIZE) {
+                // still due, tried again right away
+                armPacketTimer(t->dataBuffer, seqNo, currentTime, &expired);
+                break;
+            }
+            perror("send");
             exit(1);
         }
+        LOG_DEBUG("SOCKET: %d bytes resent (#%ld)\n", retval, seqNo);
+        TRACE(TRACE_RETRANSMIT, t->transferId, seqNo, retval);
+        ++t->socketSyscalls;
+        ++t->packetsSent;
+        ++t->retransmissions;
+        t->bytesSent += retval;
+
+        data->sent = *currentTime;
+        data->retransmitted = true;
+        armPacketTimer(t->dataBuffer, seqNo, currentTime, &t->timeout);
+    }
+}
+
+void handleTimeout(Transfer *t) {
+    uint64_t expirations;
+    if (read(t->timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        perror("read");
+        exit(1);
+    }
+    t->armed.tv_sec = LONG_MAX;
+
+    struct timeval currentTime;
+    now(&currentTime);
+    if (t->phase != PHASE_DATA) {
+        handleControlTimeout(t, &currentTime);
+        return;
+    }
+    // the receiver is gone or does not take the transfer
+    if (currentTime.tv_sec - t->lastAck.tv_sec > NO_ACK_TIMEOUT) {
+        fprintf(stderr, "%s: no ACK from the receiver for %d seconds\n", t->job->fileName,
+                NO_ACK_TIMEOUT);
+        failed = true;
+        t->phase = PHASE_DONE;
+        return;
+    }
+    long seqNo = popExpiredPacketTimer(t->dataBuffer, &currentTime);
+    if (seqNo < 0) {
+        // fired for a deadline that has moved, armTimer() sets it again
+        updateTimer(t);
+        return;
+    }
+    ++t->timeouts;
+    LOG_INFO("TIMEOUT (Current: %ld,%ld; expiration: %ld,%ld)\n",
+             currentTime.tv_sec, currentTime.tv_usec, t->timerExpiration.tv_sec,
+             t->timerExpiration.tv_usec);
+
+    if (mode == MODE_SELECTIVE) {
+        retransmitExpired(t, seqNo, &currentTime);
+    } else {
+        backoff(t);
+        congestionOnTimeout(&t->congestion);
+
+        /* YOUR TASK: (done) */
+        t->nextSendSeqNo = t->lastAckSeqNo;
+        resetTimers(t->dataBuffer);
+        /* END YOUR TASK (done) */
+    }
+    TRACE(TRACE_TIMEOUT, t->transferId, seqNo, t->rttEstimator.rto);
+    updateTimer(t);
+}
 
-        // Handle acknowledgements
-        if (FD_ISSET(s, &readfds)) {
-            uint32_t tmpCRC;
-            bool crcValid;
-            int bytesRead;
+bool canSend(Transfer *t) {
+    return t->nextSendSeqNo - t->lastAckSeqNo < getCongestionWindow(&t->congestion) &&
+           t->nextSendSeqNo <= t->veryLastSeqNo &&
+           t->nextSendSeqNo <= getLastSeqNoOfBuffer(t->dataBuffer);
+}
 
-            GoBackNMessageStruct *ack = allocateGoBackNMessageStruct(0);
-            if ((bytesRead = recv(s, ack, sizeof(*ack), MSG_DONTWAIT)) < 0) {
-                perror("recv");
-                exit(1);
+// Sends the parity packets of the group just completed. They are never
+// retransmitted, if the socket buffer is full they are simply dropped.
+void sendParity(Transfer *t, unsigned count) {
+    for (unsigned i = 0; i < count;) {
+        unsigned first = i;
+        for (; i < count; ++i) {
+            const GoBackNMessageStruct *parity = getFecParity(t->fec, i);
+            if (!addToBatch(outgoing, parity, parity->size, NULL, 0)) {
+                break;
             }
-            DEBUGOUT("SOCKET: %d bytes received\n", bytesRead);
+        }
+        int retval = sendBatch(t->s, outgoing, MSG_DONTWAIT);
+        ++t->socketSyscalls;
+        if (retval < 0) {
+            if (errno == EAGAIN || errno == ECONNREFUSED || errno == EMSGSIZE)
+                return;
+            perror("sendmmsg");
+            exit(1);
+        }
+        for (int j = 0; j < retval; ++j) {
+            t->bytesSent += getFecParity(t->fec, first + j)->size;
+        }
+        t->paritySent += retval;
+        if ((unsigned) retval < i - first) {
+            return;
+        }
+    }
+}
 
-            tmpCRC = ack->crcSum;
-            ack->crcSum = 0;
-            ack->size = sizeof(*ack);
-            crcValid = (tmpCRC == crcGoBackNMessageStruct(ack));
+// Sends as much of the window as possible. If the socket buffer is full the
+// transfer is marked blocked, the rest is sent once epoll reports the socket
+// writable.
+void sendWindow(Transfer *t) {
+    // wir duerfen neue pakete senden wenn
+    // nicht bereits die max. anzahl unacknowledgte pakete gesendet wurden (windowsize)
+    // und nextSendSeqNo muss kleiner oder gleich veryLastSeqNo sein
+
+    // lastAckSeqNo ist die seqNo, die der Empfaenger als naechstes
+    // erwartet, demnach ist (nextSendSeqNo - lastAckSeqNo) = Die Anzahl
+    // der bereits gesendeten (und unacknowledgten) Pakete
+
+    unsigned effectiveWindow = getCongestionWindow(&t->congestion);
+    while (canSend(t)) {
+        // queue as much of the window as fits into one batch
+        for (long seqNo = t->nextSendSeqNo;
+             ((seqNo - t->lastAckSeqNo) < effectiveWindow) &&
+             (seqNo <= t->veryLastSeqNo) &&
+             (seqNo <= getLastSeqNoOfBuffer(t->dataBuffer)); ++seqNo) {
+            DataPacket *data = getDataPacketFromBuffer(t->dataBuffer, seqNo);
+            if (!queueDataPacket(data)) {
+                break;
+            }
+        }
 
-            /* YOUR TASK: (done) */
-            // nur wenn valid und neu wird das ack weiter behandelt
-            if (crcValid == true && ack->seqNoExpected > lastAckSeqNo){
-              lastAckSeqNo = (ack->seqNoExpected);
-              if (nextSendSeqNo < lastAckSeqNo){
-                nextSendSeqNo = lastAckSeqNo;
-              }
-              freeBuffer(dataBuffer, getFirstSeqNoOfBuffer(dataBuffer), lastAckSeqNo - 1);
-              DataPacket* firstPacket = getDataPacketFromBuffer(dataBuffer, getFirstSeqNoOfBuffer(dataBuffer));
-
-              if (gettimeofday(&currentTime, NULL) < 0) {
-                  perror("gettimeofday");
-                  exit(1);
-              }
-
-              struct timeval maxFutureTime;
-              timeradd(&currentTime, &timeout, &maxFutureTime);
-
-              // Der folgende Teil wird nur ausgefuehrt wenn firstPacket ungleich NULL ist,
-              // da, wenn das letzte Ack vom Receiver kommt, der DataBuffer leer ist,
-              // und der Funktionsaufruf getDataPacketFromBuffer() somit gerade NULL zurueckgegeben hat.
-              if (firstPacket != NULL){
-                struct timeval timeoutFirstPacket = firstPacket->timeout;
-                if (timeoutFirstPacket.tv_sec  < 0 ||
-                    timeoutFirstPacket.tv_usec < 0 ||
-                    timercmp(&timeoutFirstPacket, &maxFutureTime, >)){
-                    timerExpiration.tv_sec = LONG_MAX;
-                    timerExpiration.tv_usec = 0;
-                } else {
-                  timerExpiration = timeoutFirstPacket;
+        // Send data
+        int retval = sendBatch(t->s, outgoing, MSG_DONTWAIT);
+        ++t->socketSyscalls;
+        if (retval < 0) {
+            if (errno == EAGAIN) {
+                t->blocked = true;
+                break;
+            }
+            if (errno == EMSGSIZE)
+                handlePathMtuDecrease(t);
+            if (errno == ECONNREFUSED || errno == EMSGSIZE)
+                break;
+            perror("sendmmsg");
+            exit(1);
+        }
+
+        LOG_DEBUG("SOCKET: %d packets sent\n", retval);
+
+        // Update timers
+        struct timeval currentTime;
+        now(&currentTime);
+
+        for (int i = 0; i < retval; ++i) {
+            DataPacket *data = getDataPacketFromBuffer(t->dataBuffer, t->nextSendSeqNo);
+            armPacketTimer(t->dataBuffer, t->nextSendSeqNo, &currentTime, &t->timeout);
+            data->sent = currentTime;
+            if (t->nextSendSeqNo < t->nextNewSeqNo) {
+                data->retransmitted = true;
+                ++t->retransmissions;
+                TRACE(TRACE_RETRANSMIT, t->transferId, t->nextSendSeqNo,
+                      data->packet->size);
+            } else {
+                t->nextNewSeqNo = t->nextSendSeqNo + 1;
+                TRACE(TRACE_SEND, t->transferId, t->nextSendSeqNo, data->packet->size);
+                if (data->packet->flags & FLAG_COMPRESSED) {
+                    ++t->compressedPackets;
+                }
+                unsigned parityReady = t->fec == NULL ? 0 :
+                        addToFecEncoder(t->fec, data->packet,
+                                        data->payload != NULL ? data->payload
+                                                              : data->packet->data,
+                                        t->nextSendSeqNo == t->veryLastSeqNo);
+                if (parityReady > 0) {
+                    sendParity(t, parityReady);
                 }
-              }
             }
+            t->bytesSent += data->packet->size;
+            ++t->packetsSent;
+            /* YOUR TASK: (done) */
+            t->nextSendSeqNo++;
             /* END YOUR TASK (done) */
+        }
+        updateTimer(t);
+    }
+}
+
+// The timerfd is only set again when the deadline has moved forward, a
+// deadline that moved back makes it fire early and handleTimeout() ignores
+// that. In Go-Back-N the deadline moves with every ACK, which saves a
+// timerfd_settime() for each of them.
+void armTimer(Transfer *t) {
+    if (t->timerExpiration.tv_sec == LONG_MAX ||
+        !timercmp(&t->timerExpiration, &t->armed, <)) {
+        return;
+    }
+
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    its.it_value.tv_sec = t->timerExpiration.tv_sec;
+    its.it_value.tv_nsec = t->timerExpiration.tv_usec * 1000L;
+    if (timerfd_settime(t->timer, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        exit(1);
+    }
+    t->armed = t->timerExpiration;
+}
+
+// Without batching every data packet costs one send() and every ACK one
+// recv(), the difference to the calls actually made is what batching saved.
+void printStatistics(Transfer *t) {
+    size_t unbatched = t->packetsSent + t->acksReceived;
+    double megabytes = t->bytesSent / (1024.0 * 1024.0);
+
+    if (t->job->streamCount > 1) {
+        printf("Transfer %s to %s:%s, stream %u of %u (bytes %" PRIu64 "-%" PRIu64 ")\n",
+               t->job->fileName, t->job->remoteName, t->job->remotePort,
+               t->job->streamId + 1, t->job->streamCount, t->job->offset,
+               t->job->offset + t->job->length);
+    } else if (jobCount > 1) {
+        printf("Transfer %s to %s:%s\n", t->job->fileName, t->job->remoteName,
+               t->job->remotePort);
+    }
+    printf("Packets sent: %zu\nBytes sent: %zu\n", t->packetsSent, t->bytesSent);
+    printf("Payload size: %zu\n", t->payloadSize);
+    if (fecGroupSize > 0) {
+        printf("Parity packets sent: %zu\n", t->paritySent);
+    }
+    if (compress) {
+        printf("Compressed packets: %zu\n", t->compressedPackets);
+    }
+    if (resume) {
+        printf("Resumed bytes: %" PRIu64 "\n", t->resumedBytes);
+        printf("Checksum: %08" PRIx32 " over %" PRIu64 " bytes (%s)\n", t->checksum.crc,
+               t->checksum.length, t->verified ? "verified" : "NOT verified");
+    }
+    printf("SRTT: %ld us\nRTO: %ld us\n", t->rttEstimator.srtt, t->rttEstimator.rto);
+    printf("Congestion window: %u (%s, ssthresh: %.1f)\n",
+           getCongestionWindow(&t->congestion), t->congestion.ops->name,
+           t->congestion.ssthresh);
+    printf("Socket syscalls: %zu (unbatched: %zu, saved per MB: %.1f)\n\n",
+           t->socketSyscalls, unbatched,
+           megabytes > 0 ? (unbatched - t->socketSyscalls) / megabytes : 0.0);
+}
+
+// One --stats record, goodput is measured since the previous one.
+void reportStatistics(Transfer *t, const char *state) {
+    struct timeval currentTime, elapsed;
+    now(&currentTime);
+    timersub(&currentTime, &t->lastStatsTime, &elapsed);
+
+    writeStats("\"program\":\"sender\",\"transfer\":\"%08x\",\"state\":\"%s\","
+               "\"packetsSent\":%zu,\"bytesSent\":%zu,\"retransmissions\":%zu,"
+               "\"timeouts\":%zu,\"paritySent\":%zu,\"acksReceived\":%zu,\"bytesAcked\":%zu,"
+               "\"inFlight\":%ld,\"window\":%u,\"ssthresh\":%.1f,\"srtt\":%ld,"
+               "\"rto\":%ld,\"goodput\":%.0f",
+               t->transferId, state, t->packetsSent, t->bytesSent, t->retransmissions,
+               t->timeouts, t->paritySent, t->acksReceived, t->bytesAcked,
+               t->nextSendSeqNo - t->lastAckSeqNo, getCongestionWindow(&t->congestion),
+               t->congestion.ssthresh, t->rttEstimator.srtt, t->rttEstimator.rto,
+               statsRate(t->bytesAcked, t->lastStatsBytes, &elapsed));
+
+    t->lastStatsBytes = t->bytesAcked;
+    t->lastStatsTime = currentTime;
+}
 
-            freeGoBackNMessageStruct(ack);
+// Starts the next job in the given slot. Returns false if there is none
+// left, jobs that cannot be started are skipped.
+bool startTransfer(Transfer *t, unsigned slot) {
+    while (nextJob < jobCount) {
+        const Job *job = &jobs[nextJob++];
+
+        memset(t, 0, sizeof(*t));
+        t->job = job;
+        t->input = fopen(job->fileName, "rb");
+        if (t->input == NULL) {
+            perror(job->fileName);
+            failed = true;
+            continue;
         }
 
-        // Handle timeout
-        if (gettimeofday(&currentTime, NULL) < 0) {
-            perror("gettimeofday");
+        // prepare channel to receiver
+        // we use "connect()" here because we have only one receiver
+        // despite using UDP, you will have to use send()/recv() later!
+        t->s = udp_connect(job->remoteName, job->remotePort);
+        if (t->s < 0) {
+            fclose(t->input);
+            failed = true;
+            continue;
+        }
+        t->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (t->timer < 0) {
+            perror("timerfd_create");
             exit(1);
         }
-        DEBUGOUT("current time: %ld,%ld\n", currentTime.tv_sec,
-                 currentTime.tv_usec);
-        if (timercmp(&timerExpiration, &currentTime, <)) {
-            DEBUGOUT("TIMEOUT (Current: %ld,%ld; expiration: %ld,%ld)\n",
-                     currentTime.tv_sec, currentTime.tv_usec, timerExpiration.tv_sec,
-                     timerExpiration.tv_usec);
+        t->slot = slot;
+        watch(t->s, EPOLL_CTL_ADD, EPOLLIN, EVENT_TAG(t, EVENT_SOCKET));
+        watch(t->timer, EPOLL_CTL_ADD, EPOLLIN, EVENT_TAG(t, EVENT_TIMER));
 
-            /* YOUR TASK: (done) */
-              nextSendSeqNo = lastAckSeqNo;
-              resetTimers(dataBuffer);
-              timerExpiration.tv_sec = LONG_MAX;
-              timerExpiration.tv_usec = 0;
-            /* END YOUR TASK (done) */
+        t->transferId = job->transferId;
+
+        // --timeout is only the initial RTO until the first RTT sample
+        initRttEstimator(&t->rttEstimator, &initialTimeout);
+        getRto(&t->rttEstimator, &t->timeout);
+        initCongestionControl(&t->congestion, congestionName, window);
+
+        t->veryLastSeqNo = LONG_MAX;
+        t->fragmentedSeqNo = -1;
+        now(&t->lastStatsTime);
+        t->timerExpiration.tv_sec = LONG_MAX;
+        t->armed.tv_sec = LONG_MAX;
+
+        if (mapFiles) {
+            mapInput(t);
+        }
+        choosePayloadSize(t);
+
+        // with --resume the receiver is asked first where the range continues
+        if (resume) {
+            t->phase = PHASE_RESUME;
+            sendControl(t);
+        } else {
+            startData(t, job->offset);
+        }
+        t->active = true;
+        return true;
+    }
+    return false;
+}
+
+void finishTransfer(Transfer *t) {
+    printStatistics(t);
+    if (statsFile != NULL) {
+        reportStatistics(t, "finished");
+    }
+    close(t->timer);  // also removes both from the epoll set
+    close(t->s);
+    if (t->input != NULL) {
+        fclose(t->input);
+    }
+    if (t->pipeline != NULL) {
+        stopPacketPipeline(t->pipeline);  // closes the eventfd
+    }
+    if (t->fec != NULL) {
+        destroyFecEncoder(t->fec);
+    }
+    if (t->compressor != NULL) {
+        destroyPayloadCompressor(t->compressor);
+    }
+    if (t->map != NULL) {
+        munmap((void *) t->map, t->mapLength);
+    }
+    deallocateDataBuffer(t->dataBuffer);
+    t->active = false;
+}
+
+// After an event: sends what the window allows, asks for EPOLLOUT while the
+// socket buffer is full and sets the retransmission timer. Returns false
+// once the transfer is finished.
+bool advance(Transfer *t) {
+    // wir sind fertig wenn die seqNo vom letzten Paket acknowledged wurde
+    if (t->phase == PHASE_DATA && t->lastAckSeqNo > t->veryLastSeqNo) {
+        t->phase = PHASE_DONE;
+        if (resume) {
+            startVerify(t);
+        }
+    }
+    if (t->phase == PHASE_DONE) {
+        return false;
+    }
+
+    if (t->phase == PHASE_DATA) {
+        bool wasBlocked = t->blocked;
+        if (!t->blocked) {
+            sendWindow(t);
+        }
+        if (t->blocked != wasBlocked) {
+            watch(t->s, EPOLL_CTL_MOD, t->blocked ? EPOLLIN | EPOLLOUT : EPOLLIN,
+                  EVENT_TAG(t, EVENT_SOCKET));
         }
+    }
+    armTimer(t);
+    return true;
+}
 
-        // Send packets
-        if (FD_ISSET(s, &writefds)) {
-            // wir duerfen neue pakete senden wenn
-            // nicht bereits die max. anzahl unacknowledgte pakete gesendet wurden (windowsize)
-            // und nextSendSeqNo muss kleiner oder gleich veryLastSeqNo sein
+int main(int argc, char **argv) {
+    // parse command line arguments
+    initialize(argc, argv);
 
-            // lastAckSeqNo ist die seqNo, die der Empfaenger als naechstes
-            // erwartet, demnach ist (nextSendSeqNo - lastAckSeqNo) = Die Anzahl
-            // der bereits gesendeten (und unacknowledgten) Pakete
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
 
-            // Hinweis: In der Debug-Ausgabe wird als nextSendSeqNo zwar eine Zahl zu
-            // hoch ausgegeben, dieses Paket wird aber nicht gesendet!
+    unsigned slots = parallel < jobCount ? parallel : (unsigned) jobCount;
+    Transfer *transfers = (Transfer *) calloc(slots, sizeof(Transfer));
+    unsigned active = 0;
+    for (unsigned slot = 0; slot < slots; ++slot) {
+        if (startTransfer(&transfers[slot], slot)) {
+            advance(&transfers[slot]);
+            ++active;
+        }
+    }
 
-            while (((nextSendSeqNo - lastAckSeqNo) < window) &&
-                    (nextSendSeqNo <= veryLastSeqNo)) {
-                DataPacket *data = getDataPacketFromBuffer(dataBuffer, nextSendSeqNo);
+    if (statsFile != NULL) {
+        now(&nextStats);
+        timeradd(&nextStats, &statsInterval, &nextStats);
+    }
 
-                // Send data
-                int retval = send(s, data->packet, data->packet->size, MSG_DONTWAIT);
-                if (retval < 0) {
-                    if (errno == EAGAIN)
-                        break;
-                    else {
-                        perror("send");
-                        exit(1);
+    struct epoll_event events[MAX_EVENTS];
+    while (active > 0) {
+        // with --stats epoll_wait() returns in time for the next report
+        int wait = -1;
+        if (statsFile != NULL) {
+            struct timeval currentTime, remaining;
+            now(&currentTime);
+            if (statsDue(&nextStats, &currentTime)) {
+                for (unsigned slot = 0; slot < slots; ++slot) {
+                    if (transfers[slot].active) {
+                        reportStatistics(&transfers[slot], "running");
                     }
                 }
+            }
+            timersub(&nextStats, &currentTime, &remaining);
+            wait = remaining.tv_sec * 1000 + (remaining.tv_usec + 999) / 1000;
+        }
+
+        int count = epoll_wait(epfd, events, MAX_EVENTS, wait);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            exit(1);
+        }
 
-                DEBUGOUT("SOCKET: %d bytes sent\n", retval);
+        for (int i = 0; i < count; ++i) {
+            uint64_t tag = events[i].data.u64;
+            unsigned slot = (uint32_t) tag >> 2;
+            Transfer *t = &transfers[slot];
+            if (!t->active || tag >> 32 != (uint64_t) (t->job - jobs)) {
+                continue;  // finished by an earlier event of this round
+            }
 
-                /* YOUR TASK: (done) */
-                nextSendSeqNo++;
-                /* END YOUR TASK (done) */
+            switch ((EventSource) (tag & 3)) {
+                case EVENT_TIMER:
+                    handleTimeout(t);
+                    break;
 
-                // Update timers
-                struct timeval currentTime;
-                if (gettimeofday(&currentTime, NULL) < 0) {
-                    perror("gettimeofday");
-                    exit(1);
-                }
-                DEBUGOUT("current time: %ld,%ld\n", currentTime.tv_sec,
-                         currentTime.tv_usec);
+                case EVENT_PIPELINE:
+                    handlePipelineEvent(t);
+                    break;
 
+                case EVENT_SOCKET:
+                    // Handle acknowledgements
+                    if (events[i].events & (EPOLLIN | EPOLLERR)) {
+                        receiveAck(t);
+                    }
+                    if (events[i].events & EPOLLOUT) {
+                        t->blocked = false;
+                        watch(t->s, EPOLL_CTL_MOD, EPOLLIN, EVENT_TAG(t, EVENT_SOCKET));
+                    }
+                    break;
+            }
 
-                /* YOUR TASK: (done) */
-                struct timeval timeoutForThisPaket;
-                timeradd(&currentTime, &timeout, &timeoutForThisPaket);
-                getDataPacketFromBuffer(dataBuffer, nextSendSeqNo - 1)->timeout = timeoutForThisPaket;
-                if (timerExpiration.tv_sec == LONG_MAX){
-                  timerExpiration = timeoutForThisPaket;
+            if (!advance(t)) {
+                finishTransfer(t);
+                if (startTransfer(t, slot)) {
+                    advance(t);
+                } else {
+                    --active;
                 }
-                /* END YOUR TASK (done) */
             }
         }
     }
-    close(s);
-    deallocateDataBuffer(dataBuffer);
-    return 0;
+
+    free(transfers);
+    close(epfd);
+    deallocateDatagramBatch(outgoing);
+    return failed ? 1 : 0;
 }
@@ -0,0 +1,66 @@
+/* Decodes a trace file written by GoBackNSender or GoBackNReceiver --trace.
+ * Prints one event per line, oldest first, as tab separated columns:
+ * time since the first event (us), event, transferId, seqNo, value. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "Trace.h"
+
+static int comparePosition(const void *a, const void *b) {
+    uint64_t pa = ((const TraceRecord *) a)->position;
+    uint64_t pb = ((const TraceRecord *) b)->position;
+    return pa < pb ? -1 : pa > pb;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "GoBackNTrace tracefile\n");
+        exit(1);
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a GoBackN trace (version %d)\n", argv[1],
+                TRACE_VERSION);
+        exit(1);
+    }
+
+    TraceRecord *records = (TraceRecord *) malloc(header.capacity * sizeof(TraceRecord));
+    size_t count = fread(records, sizeof(TraceRecord), header.capacity, file);
+    fclose(file);
+
+    // skip slots that were never written, the rest is sorted by position
+    size_t used = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (records[i].position != 0) {
+            records[used++] = records[i];
+        }
+    }
+    qsort(records, used, sizeof(TraceRecord), comparePosition);
+
+    if (used > 0 && records[0].position > 1) {
+        printf("# %" PRIu64 " earlier events were overwritten\n",
+               records[0].position - 1);
+    }
+    printf("# time_us\tevent\ttransfer\tseqNo\tvalue\n");
+    for (size_t i = 0; i < used; ++i) {
+        const TraceRecord *r = &records[i];
+        printf("%.3f\t%s\t%08" PRIx32 "\t%" PRId64 "\t%" PRId64 "\n",
+               (r->time - records[0].time) / 1000.0, traceEventName(r->event),
+               r->transferId, r->seqNo, r->value);
+    }
+
+    free(records);
+    return 0;
+}
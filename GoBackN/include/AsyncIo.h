@@ -0,0 +1,74 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+// Socket receives and file writes of a receiver worker. The backend is
+// chosen by name (--io): "select" receives with recvmmsg() and waits with
+// select(), writes are plain pwrite() calls; "uring" keeps a receive posted
+// on every slot of an io_uring and writes the output in the background, so a
+// full output buffer no longer stalls receiving. Without io_uring support
+// "uring" falls back to "select".
+typedef struct AsyncIo AsyncIo;
+
+// A file write that may still be in progress after startAsyncWrite(), data
+// must stay untouched until waitAsyncWrite() returned.
+typedef struct AsyncWrite {
+    int fd;
+    const char *data;
+    size_t size;
+    off_t offset;
+    size_t written;
+    bool pending;
+} AsyncWrite;
+
+typedef struct AsyncIoOps {
+    const char *name;
+    // returns false if the backend is not available
+    bool (*init)(AsyncIo *io);
+    void (*destroy)(AsyncIo *io);
+    int (*receive)(AsyncIo *io, const struct timeval *wait);
+    void *(*datagram)(AsyncIo *io, size_t index, size_t *length, bool *truncated,
+                      const struct sockaddr **from, socklen_t *fromlen);
+    void (*write)(AsyncIo *io, AsyncWrite *write);
+    void (*wait)(AsyncIo *io, AsyncWrite *write);
+} AsyncIoOps;
+
+struct AsyncIo {
+    const AsyncIoOps *ops;
+    int s;
+    void **slots;  // datagrams are received into these
+    size_t slotCount, slotSize;
+    size_t syscalls;  // socket syscalls made to receive
+    void *backend;
+};
+
+bool isAsyncIoBackend(const char *name);
+
+// Receives into count slots of slotSize bytes from s. Returns false if there
+// is no backend with that name or neither it nor "select" can be set up.
+bool initAsyncIo(AsyncIo *io, const char *name, int s, void **slots, size_t count,
+                 size_t slotSize);
+
+void destroyAsyncIo(AsyncIo *io);
+
+// Waits until datagrams have arrived, at most for wait (NULL: no limit,
+// zero: not at all), and returns how many, 0 if none came in time. Their
+// slots are only reused by the next call.
+int receiveDatagrams(AsyncIo *io, const struct timeval *wait);
+
+// The index-th datagram of the last receiveDatagrams().
+void *getDatagram(AsyncIo *io, size_t index, size_t *length, bool *truncated,
+                  const struct sockaddr **from, socklen_t *fromlen);
+
+void startAsyncWrite(AsyncIo *io, AsyncWrite *write, int fd, const void *data, size_t size,
+                     off_t offset);
+
+// Returns once the write is complete, right away if it never started.
+void waitAsyncWrite(AsyncIo *io, AsyncWrite *write);
+
+#endif /* ASYNC_IO_H */
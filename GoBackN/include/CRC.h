@@ -1,6 +1,14 @@
 #ifndef CRC_H
 #define CRC_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 void crc32(const void *data, size_t n_bytes, uint32_t *crc);
 
+// Continues crc over up to length bytes of the file from offset on, stops
+// at the end of the file. Returns the number of bytes covered or -1 with
+// errno set.
+int64_t crc32File(int fd, uint64_t offset, uint64_t length, uint32_t *crc);
+
 #endif /* CRC_H */
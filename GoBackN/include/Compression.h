@@ -0,0 +1,42 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Payload compression of the sender (--compress) with an LZ4 style block
+// codec: a packet carries as much of the file as compresses into its
+// payload, flagged with FLAG_COMPRESSED. Every packet decompresses on its
+// own, so the receiver handles them in any order and offset stays the file
+// position of the packet's first byte. Blocks that do not shrink are sent
+// as they are.
+
+// Upper bound for the file bytes in one packet, relative to the payload size.
+#define MAX_COMPRESSION_RATIO 8
+
+typedef struct PayloadCompressorHead *PayloadCompressor;
+
+// Reads length bytes (or up to the end) from the current position of input
+// into packets of payloadSize bytes.
+PayloadCompressor createPayloadCompressor(FILE *input, uint64_t length, size_t payloadSize);
+
+void destroyPayloadCompressor(PayloadCompressor compressor);
+
+// Makes the following packets smaller, payloadSize may only shrink.
+void setCompressorPayloadSize(PayloadCompressor compressor, size_t payloadSize);
+
+// Fills payload with the next packet's data and returns its size, 0 at the
+// end of the range. consumed is set to the file bytes it holds, compressed
+// to whether they are compressed.
+size_t compressPayload(PayloadCompressor compressor, void *payload, size_t *consumed,
+                       bool *compressed);
+
+// Decompresses one packet's payload into dst. Returns false if it is
+// malformed or does not fit into capacity bytes. With dst NULL the payload
+// is only checked.
+bool decompressPayload(const void *src, size_t size, void *dst, size_t capacity,
+                       size_t *length);
+
+#endif /* COMPRESSION_H */
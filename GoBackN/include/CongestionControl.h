@@ -0,0 +1,39 @@
+#ifndef CONGESTION_CONTROL_H
+#define CONGESTION_CONTROL_H
+
+#include <stdbool.h>
+
+// Congestion window of the sender, in packets. The algorithm is chosen by
+// name and implemented by a set of callbacks, the static --window is the
+// upper bound for all of them.
+typedef struct CongestionControl CongestionControl;
+
+typedef struct CongestionControlOps {
+    const char *name;
+    void (*init)(CongestionControl *cc);
+    // ackedPackets were newly acknowledged, rtt is the RTT sample in
+    // microseconds taken from this ACK or -1 (delay-based algorithms)
+    void (*onAck)(CongestionControl *cc, unsigned ackedPackets, long rtt);
+    void (*onTimeout)(CongestionControl *cc);
+} CongestionControlOps;
+
+struct CongestionControl {
+    const CongestionControlOps *ops;
+    unsigned maxWindow;
+    double cwnd;
+    double ssthresh;
+    long minRtt;  // smallest RTT seen so far, -1 without samples
+};
+
+// Returns false if there is no algorithm with that name.
+bool initCongestionControl(CongestionControl *cc, const char *name,
+                           unsigned maxWindow);
+
+void congestionOnAck(CongestionControl *cc, unsigned ackedPackets, long rtt);
+
+void congestionOnTimeout(CongestionControl *cc);
+
+// Number of packets that may be unacknowledged, between 1 and maxWindow.
+unsigned getCongestionWindow(const CongestionControl *cc);
+
+#endif /* CONGESTION_CONTROL_H */
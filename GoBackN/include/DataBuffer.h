@@ -4,14 +4,22 @@
 #include <sys/time.h>
 #include "GoBackNMessageStruct.h"
 
-// struct DataBufferHead;
+// Ring of packets indexed by seqNo. All slots and the packets themselves are
+// allocated once, in two contiguous blocks, when the buffer is created.
 typedef struct DataBufferHead *DataBuffer;
 typedef struct DataPacket {
-    struct timeval timeout;
-    GoBackNMessageStruct *packet;
+    struct timeval sent;  // time of the last transmission, zero if unsent
+    bool retransmitted;   // sent more than once, no RTT sample (Karn)
+    bool acked;  // selectively acknowledged (selective repeat only)
+    bool stored; // slot holds a packet (false for holes)
+    GoBackNMessageStruct *packet;  // points into the buffer's packet storage
+    // sender: the payload is kept elsewhere (the mapping of --mmap or the
+    // pipeline's ring), NULL: packet->data
+    const char *payload;
 } DataPacket;
 
-DataBuffer allocateDataBuffer(size_t maxPacketCount);
+// Every slot can hold a packet with up to maxPayloadSize data bytes.
+DataBuffer allocateDataBuffer(size_t maxPacketCount, size_t maxPayloadSize);
 
 void deallocateDataBuffer(DataBuffer buffer);
 
@@ -19,18 +27,47 @@ long getFirstSeqNoOfBuffer(DataBuffer buffer);
 
 long getLastSeqNoOfBuffer(DataBuffer buffer);
 
+// Moves an empty buffer to start at seqNo.
+void setFirstSeqNoOfBuffer(DataBuffer buffer, long seqNo);
+
 size_t getBufferSize(DataBuffer buffer);
 
 bool bufferContainsPacket(DataBuffer buffer, long seqNo);
 
 DataPacket *getDataPacketFromBuffer(DataBuffer buffer, long seqNo);
 
-void putDataPacketIntoBuffer(DataBuffer buffer, DataPacket *data);
+// Returns the slot for the packet following the last one, to be filled in
+// by the caller. The buffer must not be full.
+DataPacket *appendDataPacketToBuffer(DataBuffer buffer);
+
+// Returns the slot for seqNo, which may lie beyond the end of the buffer
+// (out-of-order packets); skipped slots stay empty. Returns NULL if the
+// seqNo is outside the buffer or already stored.
+DataPacket *storeDataPacketInBuffer(DataBuffer buffer, long seqNo);
 
 void freeBuffer(DataBuffer buffer, long start, long end);
 
 void printBuffer(DataBuffer buffer);
 
+// Retransmission timers, at most one per packet, kept in a hierarchical
+// timer wheel with a resolution of 1 ms. Arming and cancelling are O(1),
+// freeing a packet cancels its timer.
+
+// Arms (or moves) the timer of seqNo to expire at now + timeout.
+void armPacketTimer(DataBuffer buffer, long seqNo, const struct timeval *now,
+                    const struct timeval *timeout);
+
+void cancelPacketTimer(DataBuffer buffer, long seqNo);
+
+// Returns false if no timer is armed. The expiration may be earlier than the
+// actual deadline (timers further out are only sorted coarsely), but never
+// later; popExpiredPacketTimer() simply finds nothing then.
+bool getNextPacketTimer(DataBuffer buffer, struct timeval *expiration);
+
+// Disarms and returns the seqNo of one timer that has expired at now, or -1.
+long popExpiredPacketTimer(DataBuffer buffer, const struct timeval *now);
+
+// Cancels all timers.
 void resetTimers(DataBuffer buffer);
 
 #endif /* DATA_BUFFER_H */
@@ -0,0 +1,54 @@
+#ifndef DATAGRAM_BATCH_H
+#define DATAGRAM_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+// A batch of datagrams that is sent with one sendmmsg() or received with one
+// recvmmsg() call. The batch only references the datagram buffers.
+typedef struct DatagramBatchHead *DatagramBatch;
+
+DatagramBatch allocateDatagramBatch(size_t capacity);
+
+void deallocateDatagramBatch(DatagramBatch batch);
+
+size_t getBatchCapacity(DatagramBatch batch);
+
+size_t getBatchCount(DatagramBatch batch);
+
+// Queues a datagram for sending, addr may be NULL on connected sockets.
+// Returns false if the batch is full.
+bool addToBatch(DatagramBatch batch, const void *data, size_t size,
+                const struct sockaddr *addr, socklen_t addrlen);
+
+// Queues a datagram made of a header and a payload that lie apart, both are
+// gathered by the kernel without copying them together first.
+bool addPartsToBatch(DatagramBatch batch, const void *header, size_t headerSize,
+                     const void *payload, size_t payloadSize,
+                     const struct sockaddr *addr, socklen_t addrlen);
+
+// Sends the queued datagrams with one sendmmsg() call and empties the batch.
+// Returns the number of datagrams sent, or -1 with errno set.
+int sendBatch(int s, DatagramBatch batch, int flags);
+
+// Like sendBatch() but starts with the datagram at first and keeps the batch,
+// so that the rest can be sent after a partial send.
+int sendBatchFrom(int s, DatagramBatch batch, size_t first, int flags);
+
+void clearBatch(DatagramBatch batch);
+
+// Receives up to one datagram per buffer with one recvmmsg() call, blocking
+// only until the first one has arrived (unless flags contain MSG_DONTWAIT).
+// Returns the number of datagrams received, or -1 with errno set.
+int receiveBatch(int s, DatagramBatch batch, void **buffers, size_t count,
+                 size_t bufferSize, int flags);
+
+size_t getBatchLength(DatagramBatch batch, size_t index);
+
+bool isBatchTruncated(DatagramBatch batch, size_t index);
+
+const struct sockaddr *getBatchAddress(DatagramBatch batch, size_t index,
+                                       socklen_t *addrlen);
+
+#endif /* DATAGRAM_BATCH_H */
@@ -0,0 +1,51 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "GoBackNMessageStruct.h"
+
+// Forward error correction with interleaved XOR parity (--fec). Every group
+// of groupSize data packets is followed by parityCount parity packets, parity
+// packet i is the XOR of the packets at positions i, i + parityCount, ... of
+// the group. Each parity packet rebuilds one lost packet of its positions, so
+// a burst of up to parityCount consecutive losses in a group is repaired
+// without waiting for a retransmission.
+
+// dst ^= src over n bytes, with the widest vector unit the CPU has.
+void xorBytes(void *dst, const void *src, size_t n);
+
+// "group[:parity]", parity defaults to 1.
+bool parseFecSpec(const char *spec, unsigned *groupSize, unsigned *parityCount);
+
+typedef struct FecEncoderHead *FecEncoder;
+
+FecEncoder createFecEncoder(unsigned groupSize, unsigned parityCount, size_t payloadSize);
+
+void destroyFecEncoder(FecEncoder encoder);
+
+// Adds the next data packet, in seqNo order. The payload need not follow the
+// header (see --mmap). Once the group is complete (the packet is its last
+// one, or the last of the file) the number of parity packets to send is
+// returned, 0 before.
+unsigned addToFecEncoder(FecEncoder encoder, const GoBackNMessageStruct *packet,
+                         const void *payload, bool last);
+
+// Parity packet i of the group just completed, ready to be sent (CRC
+// included). Valid until the next addToFecEncoder().
+const GoBackNMessageStruct *getFecParity(FecEncoder encoder, unsigned i);
+
+typedef struct FecDecoderHead *FecDecoder;
+
+// Keeps the groups of a receive window of window packets.
+FecDecoder createFecDecoder(unsigned groupSize, unsigned parityCount, size_t payloadSize,
+                            unsigned window);
+
+void destroyFecDecoder(FecDecoder decoder);
+
+// Takes an intact data or parity packet. Returns the data packet it allows
+// to rebuild (version, type, flags, seqNo, offset, size, payloadSize and data
+// set), valid until the next call, or NULL.
+GoBackNMessageStruct *addToFecDecoder(FecDecoder decoder, const GoBackNMessageStruct *msg);
+
+#endif /* FEC_H */
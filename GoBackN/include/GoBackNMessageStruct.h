@@ -5,19 +5,108 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <limits.h>
+
+// Both endpoints drop messages of any other version.
+#define GOBACKN_VERSION 1
+
+// Data packets and ACKs make up a transfer. With --resume the sender asks
+// with MESSAGE_RESUME where the byte range starting at offset continues, the
+// receiver answers with that position in offset. Once the last packet is
+// acknowledged the sender asks with MESSAGE_VERIFY for the checksum of the
+// range from offset on, the answer carries a RangeChecksum as payload.
+// With --fec parity packets (see Fec.h) follow each group of data packets.
+typedef enum MessageType {
+    MESSAGE_DATA,
+    MESSAGE_ACK,
+    MESSAGE_RESUME,
+    MESSAGE_VERIFY,
+    MESSAGE_PARITY,
+    MESSAGE_TYPES
+} MessageType;
+
+// seqNos are 64 bits wide on the wire and kept in long by both endpoints,
+// they never wrap: even with 1 byte payloads a transfer would have to run
+// for centuries at line rate.
+#if LONG_MAX < INT64_MAX
+#error "seqNos are kept in long, which has to hold 64 bits"
+#endif
 
 typedef struct GoBackNMessageStruct {
-    uint32_t size;  // including these header fields
-    int32_t seqNo;
-    int32_t seqNoExpected;
+    uint32_t size;     // including these header fields
+    uint8_t version;   // GOBACKN_VERSION
+    uint8_t type;      // MessageType
+    uint16_t flags;    // FLAG_*, 0 unless stated otherwise
     uint32_t crcSum;
+    // The transferId tells apart transfers a receiver serves at the same
+    // time, also several from one source address. A parallel transfer sends
+    // the byte ranges of one file as streams over separate sockets, all with
+    // the same transferId; the receiver writes each packet's data at its
+    // offset.
+    uint32_t transferId;  // chosen by the sender, echoed in ACKs
+    int64_t seqNo;
+    int64_t seqNoExpected;  // ACKs: the next seqNo the receiver expects
+    uint64_t offset;        // file position of data[0]
+    uint32_t payloadSize;   // data packets: the payload size the sender uses
+    uint16_t streamId;      // byte range of a parallel transfer, 0 otherwise
+    uint16_t streamCount;   // ranges the file is split into, 1 otherwise
     char data[0];
 } __attribute__((packed, aligned(1))) GoBackNMessageStruct;
 
+// Data packets: the payload is compressed (see Compression.h), offset is the
+// file position of its first byte after decompression.
+#define FLAG_COMPRESSED 0x0001
+
+// Largest payload that fits into a single UDP/IPv4 datagram.
+#define MAX_PAYLOAD_SIZE (65507 - sizeof(GoBackNMessageStruct))
+
+typedef struct RangeChecksum {
+    uint64_t length;  // bytes covered, up to the end of the file
+    uint32_t crc;
+} __attribute__((packed, aligned(1))) RangeChecksum;
+
+// Payload of a parity packet, followed by the XOR of the payloads it covers
+// (zero padded to the longest). The group consists of the groupSize data
+// packets from the parity packet's seqNo on, the parity packet covers those
+// at positions index, index + parityCount, ...
+typedef struct ParityInfo {
+    uint16_t groupSize;  // fewer than configured for the last group
+    uint8_t parityCount;
+    uint8_t index;
+    uint32_t lengthXor;  // of the payload lengths
+    uint64_t offsetXor;  // of the file positions
+    uint16_t flagsXor;
+} __attribute__((packed, aligned(1))) ParityInfo;
+
+#define MAX_FEC_GROUP 64
+
+// Retransmission strategy, both endpoints have to use the same one.
+// With selective repeat the receiver puts the seqNo of the received packet
+// into the seqNo field of the ACK (-1 otherwise).
+typedef enum TransferMode {
+    MODE_GOBACKN,
+    MODE_SELECTIVE
+} TransferMode;
+
+bool parseTransferMode(const char *name, TransferMode *mode);
+
 GoBackNMessageStruct *allocateGoBackNMessageStruct(size_t dataSize);
 
+// Fills in the version and type of a message to be sent.
+void initGoBackNMessageStruct(GoBackNMessageStruct *msg, MessageType type);
+
+// Checks what does not depend on the state of a transfer: the version, the
+// type, the length for the type and that the seqNos are in range. length is
+// the number of bytes actually received, the size field has to match it.
+bool isValidGoBackNMessage(const GoBackNMessageStruct *msg, size_t length);
+
 void freeGoBackNMessageStruct(GoBackNMessageStruct *msg);
 
+// CRC of the size bytes of msg, crcSum has to be 0.
 uint32_t crcGoBackNMessageStruct(GoBackNMessageStruct *msg);
 
+// Compares crcSum with the CRC the sender computed while crcSum was 0,
+// without touching the received message. The size has to be validated.
+bool checkCrcGoBackNMessageStruct(const GoBackNMessageStruct *msg);
+
 #endif /* GOBACKN_MESSAGE_STRUCT_H */
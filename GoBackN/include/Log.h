@@ -0,0 +1,39 @@
+#ifndef LOG_H
+#define LOG_H
+
+// Leveled logging to stderr. Messages above LOG_LEVEL are compiled out, debug
+// messages only exist in debug builds (CMAKE_BUILD_TYPE=Debug). Messages
+// above the runtime level, raised by --verbose, are skipped.
+#define LEVEL_ERROR   0
+#define LEVEL_WARNING 1
+#define LEVEL_INFO    2
+#define LEVEL_DEBUG   3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LEVEL_INFO
+#endif
+
+extern int logLevel;  // runtime level, LEVEL_WARNING by default
+
+void logMessage(int level, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, ...) \
+    do { if ((level) <= logLevel) logMessage(level, __VA_ARGS__); } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LEVEL_WARNING, __VA_ARGS__)
+
+#if LOG_LEVEL >= LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#endif /* LOG_H */
@@ -0,0 +1,27 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "AsyncIo.h"
+
+// Sequential output file written through a large aligned buffer. The data is
+// written with pwrite() whenever the buffer is full, and disk space is
+// reserved in large extents ahead of the write position. With an AsyncIo a
+// full buffer is written in the background while a second one fills.
+typedef struct OutputBufferHead *OutputBuffer;
+
+// Writes sequentially from offset into a file other buffers write to as
+// well, e.g. the byte ranges of a parallel transfer. The fd stays open when
+// the buffer is closed. io may be NULL.
+OutputBuffer openOutputRange(int fd, off_t offset, size_t capacity, AsyncIo *io);
+
+void appendToOutputBuffer(OutputBuffer out, const void *data, size_t size);
+
+// Returns once everything appended so far is written.
+void flushOutputBuffer(OutputBuffer out);
+
+// Flushes the buffer, the fd stays open.
+void closeOutputBuffer(OutputBuffer out);
+
+#endif /* OUTPUT_BUFFER_H */
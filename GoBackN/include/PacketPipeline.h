@@ -0,0 +1,47 @@
+#ifndef PACKET_PIPELINE_H
+#define PACKET_PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "GoBackNMessageStruct.h"
+
+// Prepares the packets of a file ahead of the sender. A reader thread reads
+// the payloads into a ring of packets, checksum threads fill in the CRCs and
+// the sending thread takes the packets in seqNo order. Every stage publishes
+// how far it got and the next stage follows, so the ring is a chain of
+// single-producer single-consumer queues without locks. A stage only sleeps
+// when there is nothing to do.
+typedef struct PacketPipelineHead *PacketPipeline;
+
+// Starts reading length bytes (or up to the end) from offset of input, which
+// then belongs to the pipeline, into depth packets of payloadSize bytes. The
+// packets get the transferId and stream fields of header and are numbered
+// from 0, the last one is empty. With compress the reader compresses the
+// payloads (see Compression.h).
+PacketPipeline startPacketPipeline(FILE *input, uint64_t offset, uint64_t length,
+                                   size_t payloadSize, const GoBackNMessageStruct *header,
+                                   size_t depth, unsigned checksumThreads, bool compress);
+
+// Returns the next packet or NULL if it is not ready yet.
+const GoBackNMessageStruct *peekPipelinePacket(PacketPipeline pipeline);
+
+// Moves on to the following packet. The packet taken stays valid (in its
+// ring slot) until it is released.
+void takePipelinePacket(PacketPipeline pipeline);
+
+// Hands the oldest count packets taken back to the reader.
+void releasePipelinePackets(PacketPipeline pipeline, size_t count);
+
+// Packets read from now on carry at most payloadSize bytes, it may only
+// shrink. The packets already read keep their size.
+void setPipelinePayloadSize(PacketPipeline pipeline, size_t payloadSize);
+
+// An eventfd that becomes readable when a packet is ready after
+// peekPipelinePacket() returned NULL. The caller drains it.
+int getPipelineEventFd(PacketPipeline pipeline);
+
+// Stops the threads and closes the input and the eventfd.
+void stopPacketPipeline(PacketPipeline pipeline);
+
+#endif /* PACKET_PIPELINE_H */
@@ -0,0 +1,38 @@
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+
+#include <stdbool.h>
+#include <sys/time.h>
+
+// Retransmission timeout computation as in RFC 6298, all values in
+// microseconds. The lower bound is far below the RFC's one second so that a
+// loss on a fast path is recovered quickly, but still above the delays of
+// delayed ACKs and scheduling on the receiver.
+#define RTT_MIN_RTO 20000L
+#define RTT_MAX_RTO 60000000L
+
+typedef struct RttEstimator {
+    bool hasSample;
+    long srtt;
+    long rttvar;
+    long baseRto;     // RTO computed from the samples
+    unsigned backoff; // number of doublings since the last progress
+    long rto;         // baseRto after backoff, the one to use
+} RttEstimator;
+
+void initRttEstimator(RttEstimator *est, const struct timeval *initialRto);
+
+// Adds a sample of a packet that was sent only once (Karn's rule).
+void addRttSample(RttEstimator *est, const struct timeval *rtt);
+
+// Doubles the RTO after a timeout.
+void backoffRto(RttEstimator *est);
+
+// Undoes the backoff once an ACK acknowledges new data. Like Linux, and
+// unlike strict Karn, this does not wait for a valid sample, which a
+// Go-Back-N sender rarely gets right after a retransmission of its window.
+void resetRtoBackoff(RttEstimator *est);
+
+void getRto(const RttEstimator *est, struct timeval *rto);
+
+#endif /* RTT_ESTIMATOR_H */
@@ -1,8 +1,32 @@
 #ifndef SOCKET_CONNECTION_H_
 #define SOCKET_CONNECTION_H_
 
+#include <stddef.h>
+
 int udp_connect(const char *host, const char *serv);
 
 int udp_server(const char *host, const char *serv, socklen_t *addrlenp);
 
+/* Like udp_server(), but several sockets may be bound to the same port
+ * (SO_REUSEPORT). The kernel spreads incoming datagrams over them by the
+ * source address, so one peer always reaches the same socket. */
+int udp_server_shared(const char *host, const char *serv, socklen_t *addrlenp);
+
+/* Turns on path MTU discovery (DF bit) for a connected socket and returns the
+ * largest UDP payload that fits into the path MTU, or -1. */
+int udp_probe_payload(int sockfd);
+
+/* The largest UDP payload that fits into the path MTU the kernel currently
+ * knows for a connected socket, e.g. after a send failed with EMSGSIZE, or
+ * -1. */
+int udp_path_payload(int sockfd);
+
+/* Asks for socket send and receive buffers of the given size (the kernel
+ * caps them at net.core.[rw]mem_max, larger sizes than INT_MAX are capped
+ * at that first). */
+void udp_set_buffer_size(int sockfd, size_t bytes);
+
+/* Lets the kernel fragment datagrams larger than the path MTU again. */
+void udp_allow_fragmentation(int sockfd);
+
 #endif /* SOCKET_CONNECTION_H_ */
@@ -0,0 +1,27 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+// Live statistics as JSON lines. The programs count into their own transfer
+// and flow structures, which costs an increment on the hot path, and write
+// one record per transfer every statsInterval.
+extern FILE *statsFile;  // NULL unless --stats
+extern struct timeval statsInterval;
+
+// Opens the statistics file, "-" is stdout.
+bool openStats(const char *fileName, unsigned intervalMs);
+
+// True if a report is due at now, then moves next on by one interval.
+bool statsDue(struct timeval *next, const struct timeval *now);
+
+// Writes one record. format gives the fields after "time" (wall clock
+// seconds), without the braces.
+void writeStats(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Bytes per second between two reports.
+double statsRate(size_t bytes, size_t lastBytes, const struct timeval *elapsed);
+
+#endif /* STATS_H */
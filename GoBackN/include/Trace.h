@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary trace of protocol events. The events are kept in a ring in memory
+// and written to the trace file at exit and on SIGUSR1. GoBackNTrace decodes
+// the file. Recording is lock-free, threads only share an atomic counter.
+typedef enum TraceEvent {
+    TRACE_SEND = 1,    // sender: seqNo, value: bytes
+    TRACE_RETRANSMIT,  // sender: seqNo, value: bytes
+    TRACE_ACK,         // sender: seqNo of the ACK, value: seqNoExpected
+    TRACE_TIMEOUT,     // sender: seqNo that expired, value: backed off RTO (us)
+    TRACE_RECEIVE,     // receiver: seqNo, value: bytes
+    TRACE_CORRUPT,     // receiver: CRC error, seqNo as received, value: bytes
+    TRACE_ACK_SENT     // receiver: seqNo of the ACK, value: seqNoExpected
+} TraceEvent;
+
+#define TRACE_MAGIC "GBNTRACE"
+#define TRACE_VERSION 1
+
+typedef struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;  // records following the header, oldest ones overwritten
+} TraceHeader;
+
+typedef struct TraceRecord {
+    uint64_t position;  // 1 + number of earlier events, 0 if never written
+    uint64_t time;      // CLOCK_MONOTONIC, ns
+    uint32_t transferId;
+    uint32_t event;
+    int64_t seqNo;
+    int64_t value;
+} TraceRecord;
+
+extern TraceRecord *traceRing;  // NULL unless tracing
+
+// Starts tracing into a ring of at least capacity records.
+bool openTrace(const char *fileName, size_t capacity);
+
+void traceEvent(TraceEvent event, uint32_t transferId, long seqNo, long value);
+
+#define TRACE(event, transferId, seqNo, value) \
+    do { \
+        if (traceRing != NULL) traceEvent(event, transferId, seqNo, value); \
+    } while (0)
+
+// Writes the ring to the trace file, only uses async-signal-safe calls.
+void dumpTrace(void);
+
+const char *traceEventName(uint32_t event);
+
+#endif /* TRACE_H */
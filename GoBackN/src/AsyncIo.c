@@ -0,0 +1,502 @@
+#define _GNU_SOURCE
+#include "AsyncIo.h"
+#include "DatagramBatch.h"
+#include "Log.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+/* select: recvmmsg() into all slots, select() until the deadline when
+ * nothing is there, pwrite() right away */
+
+static bool selectInit(AsyncIo *io) {
+    io->backend = allocateDatagramBatch(io->slotCount);
+    return true;
+}
+
+static void selectDestroy(AsyncIo *io) {
+    deallocateDatagramBatch((DatagramBatch) io->backend);
+}
+
+static int selectReceive(AsyncIo *io, const struct timeval *wait) {
+    int count = receiveBatch(io->s, (DatagramBatch) io->backend, io->slots, io->slotCount,
+                             io->slotSize, wait != NULL ? MSG_DONTWAIT : 0);
+    ++io->syscalls;
+    if (count >= 0) {
+        return count;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        perror("recvmmsg");
+        exit(1);
+    }
+    if (wait == NULL || !timerisset(wait)) {
+        return 0;
+    }
+
+    struct timeval timeout = *wait;
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(io->s, &readfds);
+    if (select(io->s + 1, &readfds, NULL, NULL, &timeout) < 0 && errno != EINTR) {
+        perror("select");
+        exit(1);
+    }
+    return 0;
+}
+
+static void *selectDatagram(AsyncIo *io, size_t index, size_t *length, bool *truncated,
+                            const struct sockaddr **from, socklen_t *fromlen) {
+    DatagramBatch batch = (DatagramBatch) io->backend;
+    *length = getBatchLength(batch, index);
+    *truncated = isBatchTruncated(batch, index);
+    *from = getBatchAddress(batch, index, fromlen);
+    return io->slots[index];
+}
+
+static void selectWrite(AsyncIo *io, AsyncWrite *write) {
+    (void) io;
+    while (write->written < write->size) {
+        ssize_t retval = pwrite(write->fd, write->data + write->written,
+                                write->size - write->written,
+                                write->offset + (off_t) write->written);
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("pwrite");
+            exit(1);
+        }
+        write->written += retval;
+    }
+    write->pending = false;
+}
+
+static void selectWait(AsyncIo *io, AsyncWrite *write) {
+    (void) io;
+    (void) write;
+}
+
+#ifdef HAVE_IO_URING
+
+/* uring: every slot has a recvmsg posted on the ring, one io_uring_enter()
+ * submits the reposted slots and waits for the next datagrams or the
+ * deadline. Writes complete on the same ring while receiving goes on. */
+
+#define WRITE_ENTRIES 64  // submission queue room beyond one receive per slot
+#define RECEIVE_TAG 1     // user_data: slot << 1 | RECEIVE_TAG, else the AsyncWrite
+#define CANCEL_TAG 0
+
+typedef struct UringBackend {
+    int fd;
+    unsigned *sqHead, *sqTail, *sqMask;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    unsigned sqEntries;
+    unsigned tail;  // next free sqe, the kernel sees it on the next enter
+
+    // per slot
+    struct msghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_storage *addrs;
+    size_t *lengths;  // as received, beyond slotSize if truncated
+
+    // slots with a datagram in completion order, the first returned ones
+    // went to the caller with the last receive
+    unsigned *ready;
+    size_t readyCount, returned;
+    size_t receiving;  // receives posted and not completed
+    bool closing;
+} UringBackend;
+
+static void unmapRing(UringBackend *u) {
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqesSize);
+    }
+    if (u->cqRing != NULL && u->cqRing != MAP_FAILED && u->cqRing != u->sqRing) {
+        munmap(u->cqRing, u->cqRingSize);
+    }
+    if (u->sqRing != NULL && u->sqRing != MAP_FAILED) {
+        munmap(u->sqRing, u->sqRingSize);
+    }
+}
+
+// Hands the queued sqes to the kernel and waits for minComplete
+// completions, at most for wait.
+static void enterRing(UringBackend *u, unsigned minComplete, const struct timeval *wait) {
+    __atomic_store_n(u->sqTail, u->tail, __ATOMIC_RELEASE);
+    unsigned toSubmit = u->tail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE);
+
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void *argp = NULL;
+    size_t argsz = 0;
+    if (minComplete > 0 && wait != NULL) {
+        ts.tv_sec = wait->tv_sec;
+        ts.tv_nsec = (long long) wait->tv_usec * 1000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    if (toSubmit == 0 && minComplete == 0) {
+        return;
+    }
+    if (syscall(__NR_io_uring_enter, u->fd, toSubmit, minComplete, flags, argp,
+                argsz) < 0 &&
+        errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        perror("io_uring_enter");
+        exit(1);
+    }
+}
+
+static struct io_uring_sqe *nextSqe(UringBackend *u) {
+    while (u->tail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) >= u->sqEntries) {
+        enterRing(u, 0, NULL);
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->tail & *u->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++u->tail;
+    return sqe;
+}
+
+// MSG_TRUNC makes the kernel report the full length of a datagram that did
+// not fit into the slot.
+static void postReceive(AsyncIo *io, UringBackend *u, unsigned slot) {
+    u->msgs[slot].msg_namelen = sizeof(u->addrs[slot]);
+    struct io_uring_sqe *sqe = nextSqe(u);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = io->s;
+    sqe->addr = (uint64_t) (uintptr_t) &u->msgs[slot];
+    sqe->len = 1;
+    sqe->msg_flags = MSG_TRUNC;
+    sqe->user_data = (uint64_t) slot << 1 | RECEIVE_TAG;
+    ++u->receiving;
+}
+
+static void postWrite(UringBackend *u, AsyncWrite *write) {
+    struct io_uring_sqe *sqe = nextSqe(u);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = write->fd;
+    sqe->addr = (uint64_t) (uintptr_t) (write->data + write->written);
+    sqe->len = (uint32_t) (write->size - write->written);
+    sqe->off = (uint64_t) write->offset + write->written;
+    sqe->user_data = (uint64_t) (uintptr_t) write;
+}
+
+static void complete(AsyncIo *io, UringBackend *u, uint64_t tag, int res) {
+    if (tag == CANCEL_TAG) {
+        return;
+    }
+    if (tag & RECEIVE_TAG) {
+        unsigned slot = (unsigned) (tag >> 1);
+        --u->receiving;
+        if (u->closing) {
+            return;
+        }
+        if (res < 0) {
+            if (res != -EINTR && res != -EAGAIN) {
+                LOG_WARNING("recvmsg: %s\n", strerror(-res));
+            }
+            postReceive(io, u, slot);
+            return;
+        }
+        u->lengths[slot] = (size_t) res;
+        u->ready[u->readyCount++] = slot;
+        return;
+    }
+
+    AsyncWrite *write = (AsyncWrite *) (uintptr_t) tag;
+    if (res == -EINTR || res == -EAGAIN) {
+        postWrite(u, write);
+        return;
+    }
+    if (res <= 0) {
+        errno = res < 0 ? -res : EIO;
+        perror("write");
+        exit(1);
+    }
+    write->written += (size_t) res;
+    if (write->written < write->size) {
+        postWrite(u, write);
+    } else {
+        write->pending = false;
+    }
+}
+
+static void reapCompletions(AsyncIo *io, UringBackend *u) {
+    unsigned head = *u->cqHead;
+    unsigned tail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cqMask];
+        complete(io, u, cqe->user_data, cqe->res);
+        ++head;
+    }
+    __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+}
+
+// The deadline comes with io_uring_enter() itself (IORING_FEAT_EXT_ARG,
+// Linux 5.11), older kernels use select.
+static bool uringInit(AsyncIo *io) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, (unsigned) io->slotCount + WRITE_ENTRIES,
+                           &params);
+    if (fd < 0) {
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        return false;
+    }
+
+    UringBackend *u = (UringBackend *) calloc(1, sizeof(*u));
+    u->fd = fd;
+    u->sqEntries = params.sq_entries;
+    u->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cqRingSize > u->sqRingSize) {
+            u->sqRingSize = u->cqRingSize;
+        }
+        u->cqRingSize = u->sqRingSize;
+    }
+    u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+    u->cqRing = params.features & IORING_FEAT_SINGLE_MMAP
+                ? u->sqRing
+                : mmap(NULL, u->cqRingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    u->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *) mmap(NULL, u->sqesSize, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqRing == MAP_FAILED || u->cqRing == MAP_FAILED || u->sqes == MAP_FAILED) {
+        unmapRing(u);
+        close(fd);
+        free(u);
+        return false;
+    }
+
+    char *sq = (char *) u->sqRing, *cq = (char *) u->cqRing;
+    u->sqHead = (unsigned *) (sq + params.sq_off.head);
+    u->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    u->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    u->cqHead = (unsigned *) (cq + params.cq_off.head);
+    u->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    u->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    u->tail = *u->sqTail;
+    // sqes are used in ring order
+    unsigned *array = (unsigned *) (sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; ++i) {
+        array[i] = i;
+    }
+
+    u->msgs = (struct msghdr *) calloc(io->slotCount, sizeof(struct msghdr));
+    u->iovs = (struct iovec *) calloc(io->slotCount, sizeof(struct iovec));
+    u->addrs = (struct sockaddr_storage *) calloc(io->slotCount,
+                                                  sizeof(struct sockaddr_storage));
+    u->lengths = (size_t *) calloc(io->slotCount, sizeof(size_t));
+    u->ready = (unsigned *) calloc(io->slotCount, sizeof(unsigned));
+    io->backend = u;
+    for (unsigned i = 0; i < io->slotCount; ++i) {
+        u->iovs[i].iov_base = io->slots[i];
+        u->iovs[i].iov_len = io->slotSize;
+        u->msgs[i].msg_name = &u->addrs[i];
+        u->msgs[i].msg_iov = &u->iovs[i];
+        u->msgs[i].msg_iovlen = 1;
+        postReceive(io, u, i);
+    }
+    return true;
+}
+
+// Closing the ring cancels in the background, so the posted receives are
+// cancelled and waited for before their slots may be freed.
+static void uringDestroy(AsyncIo *io) {
+    UringBackend *u = (UringBackend *) io->backend;
+    u->closing = true;
+    reapCompletions(io, u);
+
+    bool *posted = (bool *) calloc(io->slotCount, sizeof(bool));
+    for (unsigned i = 0; i < io->slotCount; ++i) {
+        posted[i] = true;
+    }
+    for (size_t i = 0; i < u->readyCount; ++i) {
+        posted[u->ready[i]] = false;
+    }
+    for (unsigned i = 0; i < io->slotCount; ++i) {
+        if (posted[i]) {
+            struct io_uring_sqe *sqe = nextSqe(u);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t) i << 1 | RECEIVE_TAG;
+            sqe->user_data = CANCEL_TAG;
+        }
+    }
+    free(posted);
+    while (u->receiving > 0) {
+        enterRing(u, 1, NULL);
+        reapCompletions(io, u);
+    }
+
+    unmapRing(u);
+    close(u->fd);
+    free(u->msgs);
+    free(u->iovs);
+    free(u->addrs);
+    free(u->lengths);
+    free(u->ready);
+    free(u);
+}
+
+static int uringReceive(AsyncIo *io, const struct timeval *wait) {
+    UringBackend *u = (UringBackend *) io->backend;
+
+    // the datagrams returned last time are handled, their slots receive again
+    for (size_t i = 0; i < u->returned; ++i) {
+        postReceive(io, u, u->ready[i]);
+    }
+    u->readyCount -= u->returned;
+    memmove(u->ready, u->ready + u->returned, u->readyCount * sizeof(unsigned));
+    u->returned = 0;
+
+    reapCompletions(io, u);
+    bool block = u->readyCount == 0 && (wait == NULL || timerisset(wait));
+    if (block || u->tail != *u->sqTail) {
+        enterRing(u, block ? 1 : 0, wait);
+        ++io->syscalls;
+        reapCompletions(io, u);
+    }
+
+    u->returned = u->readyCount;
+    return (int) u->readyCount;
+}
+
+static void *uringDatagram(AsyncIo *io, size_t index, size_t *length, bool *truncated,
+                           const struct sockaddr **from, socklen_t *fromlen) {
+    UringBackend *u = (UringBackend *) io->backend;
+    unsigned slot = u->ready[index];
+    *truncated = u->lengths[slot] > io->slotSize;
+    *length = *truncated ? io->slotSize : u->lengths[slot];
+    *from = (const struct sockaddr *) &u->addrs[slot];
+    *fromlen = u->msgs[slot].msg_namelen;
+    return io->slots[slot];
+}
+
+static void uringWrite(AsyncIo *io, AsyncWrite *write) {
+    UringBackend *u = (UringBackend *) io->backend;
+    postWrite(u, write);
+    enterRing(u, 0, NULL);
+}
+
+static void uringWait(AsyncIo *io, AsyncWrite *write) {
+    UringBackend *u = (UringBackend *) io->backend;
+    reapCompletions(io, u);
+    while (write->pending) {
+        enterRing(u, 1, NULL);
+        reapCompletions(io, u);
+    }
+}
+
+#else
+
+static bool uringInit(AsyncIo *io) {
+    (void) io;
+    return false;
+}
+
+#define uringDestroy NULL
+#define uringReceive NULL
+#define uringDatagram NULL
+#define uringWrite NULL
+#define uringWait NULL
+
+#endif /* HAVE_IO_URING */
+
+static const AsyncIoOps backends[] = {
+        {"select", selectInit, selectDestroy, selectReceive, selectDatagram, selectWrite,
+                selectWait},
+        {"uring",  uringInit,  uringDestroy,  uringReceive,  uringDatagram,  uringWrite,
+                uringWait},
+};
+
+static const AsyncIoOps *findBackend(const char *name) {
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        if (strcmp(backends[i].name, name) == 0) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+bool isAsyncIoBackend(const char *name) {
+    return findBackend(name) != NULL;
+}
+
+bool initAsyncIo(AsyncIo *io, const char *name, int s, void **slots, size_t count,
+                 size_t slotSize) {
+    io->ops = findBackend(name);
+    if (io->ops == NULL) {
+        return false;
+    }
+    io->s = s;
+    io->slots = slots;
+    io->slotCount = count;
+    io->slotSize = slotSize;
+    io->syscalls = 0;
+    io->backend = NULL;
+    if (io->ops->init(io)) {
+        return true;
+    }
+
+    LOG_WARNING("I/O backend %s not available, using select\n", name);
+    io->ops = &backends[0];
+    return io->ops->init(io);
+}
+
+void destroyAsyncIo(AsyncIo *io) {
+    io->ops->destroy(io);
+}
+
+int receiveDatagrams(AsyncIo *io, const struct timeval *wait) {
+    return io->ops->receive(io, wait);
+}
+
+void *getDatagram(AsyncIo *io, size_t index, size_t *length, bool *truncated,
+                  const struct sockaddr **from, socklen_t *fromlen) {
+    return io->ops->datagram(io, index, length, truncated, from, fromlen);
+}
+
+void startAsyncWrite(AsyncIo *io, AsyncWrite *write, int fd, const void *data, size_t size,
+                     off_t offset) {
+    write->fd = fd;
+    write->data = (const char *) data;
+    write->size = size;
+    write->offset = offset;
+    write->written = 0;
+    write->pending = true;
+    io->ops->write(io, write);
+}
+
+void waitAsyncWrite(AsyncIo *io, AsyncWrite *write) {
+    if (write->pending) {
+        io->ops->wait(io, write);
+    }
+}
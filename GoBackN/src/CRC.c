@@ -1,24 +1,204 @@
-/* Simple public domain implementation of the standard CRC32 checksum. */
+/* Standard CRC32 checksum (polynomial 0xEDB88320, as used by zlib).
+ *
+ * Three backends compute the same value: a byte-at-a-time table lookup,
+ * slicing-by-8 over precomputed tables, and a PCLMULQDQ folding kernel on
+ * x86 CPUs that support it. The backend is selected once at startup. */
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
-uint32_t crc32_for_byte(uint32_t r) {
-    for (int j = 0; j < 8; ++j) {
-        r = (r & 1 ? 0 : (uint32_t) 0xEDB88320L) ^ r >> 1;
+#include "CRC.h"
+#include "CRC32Table.h"
+
+static uint32_t crc32Bytewise(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    for (size_t i = 0; i < n_bytes; ++i) {
+        crc = crc32Table[0][(uint8_t) crc ^ data[i]] ^ crc >> 8;
+    }
+    return crc;
+}
+
+static uint32_t crc32Slicing8(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (n_bytes >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, data, sizeof(lo));
+        memcpy(&hi, data + 4, sizeof(hi));
+        lo ^= crc;
+
+        crc = crc32Table[7][lo & 0xff] ^
+              crc32Table[6][(lo >> 8) & 0xff] ^
+              crc32Table[5][(lo >> 16) & 0xff] ^
+              crc32Table[4][lo >> 24] ^
+              crc32Table[3][hi & 0xff] ^
+              crc32Table[2][(hi >> 8) & 0xff] ^
+              crc32Table[1][(hi >> 16) & 0xff] ^
+              crc32Table[0][hi >> 24];
+
+        data += 8;
+        n_bytes -= 8;
+    }
+#endif
+    return crc32Bytewise(crc, data, n_bytes);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* Folding kernel from Intel's "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction" with the bit-reflected constants for the
+ * CRC32 polynomial. Requires n_bytes >= 64 and a multiple of 16. */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32FoldClmul(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    data += 64;
+    n_bytes -= 64;
+
+    // fold four 128 bit lanes in parallel
+    x0 = k1k2;
+    while (n_bytes >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *) (data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *) (data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *) (data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *) (data + 0x30)));
+
+        data += 64;
+        n_bytes -= 64;
+    }
+
+    // fold the four lanes into one
+    x0 = k3k4;
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // remaining 16 byte blocks
+    while (n_bytes >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *) data);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        data += 16;
+        n_bytes -= 16;
+    }
+
+    // 128 -> 64 bit
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = k5k0;
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bit
+    x0 = poly;
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32Clmul(uint32_t crc, const uint8_t *data, size_t n_bytes) {
+    if (n_bytes >= 64) {
+        size_t folded = n_bytes & ~(size_t) 15;
+        crc = crc32FoldClmul(crc, data, folded);
+        data += folded;
+        n_bytes -= folded;
+    }
+    return crc32Slicing8(crc, data, n_bytes);
+}
+#endif
+
+typedef uint32_t (*Crc32Backend)(uint32_t crc, const uint8_t *data, size_t n_bytes);
+
+static Crc32Backend crc32Backend = crc32Slicing8;
+
+// runs before main(), so the backend is never changed while threads are running
+__attribute__((constructor))
+static void selectCrc32Backend(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crc32Backend = crc32Clmul;
     }
-    return r ^ (uint32_t) 0xFF000000L;
+#endif
 }
 
 void crc32(const void *data, size_t n_bytes, uint32_t *crc) {
-    static uint32_t table[0x100];
-    if (!*table) {
-        for (size_t i = 0; i < 0x100; ++i) {
-            table[i] = crc32_for_byte(i);
-        }
+    *crc = ~crc32Backend(~*crc, (const uint8_t *) data, n_bytes);
+}
+
+#define FILE_CHUNK (1024 * 1024)
+
+int64_t crc32File(int fd, uint64_t offset, uint64_t length, uint32_t *crc) {
+    uint8_t *buffer = (uint8_t *) malloc(FILE_CHUNK);
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return -1;
     }
-    for (size_t i = 0; i < n_bytes; ++i) {
-        *crc = table[(uint8_t) *crc ^ ((uint8_t *) data)[i]] ^ *crc >> 8;
+
+    uint64_t covered = 0;
+    while (covered < length) {
+        size_t chunk = length - covered < FILE_CHUNK ? (size_t) (length - covered)
+                                                     : FILE_CHUNK;
+        ssize_t retval = pread(fd, buffer, chunk, (off_t) (offset + covered));
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            free(buffer);
+            return -1;
+        }
+        if (retval == 0) {
+            break;
+        }
+        crc32(buffer, (size_t) retval, crc);
+        covered += retval;
     }
+    free(buffer);
+    return (int64_t) covered;
 }
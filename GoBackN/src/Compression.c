@@ -0,0 +1,285 @@
+#include "Compression.h"
+#include <stdlib.h>
+#include <string.h>
+
+// A block is a sequence of LZ4 style sequences: a token with the literal
+// count in the high and the match length - MIN_MATCH in the low nibble
+// (15: more bytes follow, each adding up to 255), the literals, a 16 bit
+// little endian offset back into the output and the rest of the match
+// length. The last sequence ends after its literals.
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_LOG 12
+#define SKIP_STRENGTH 6  // step ahead faster the longer no match is found
+#define MAX_BACKOFF 64   // blocks sent as they are after one that did not shrink
+
+typedef struct PayloadCompressorHead {
+    FILE *input;
+    uint64_t unread;  // bytes of the range not read from input yet
+    size_t payloadSize;
+    size_t blockSize;  // file bytes tried per packet
+    // after a block that did not shrink the next backoff ones are not even
+    // tried, doubling up to MAX_BACKOFF while the data stays incompressible
+    unsigned backoff, skip;
+
+    // read ahead of the packets, the bytes not consumed yet are start..end
+    uint8_t *buffer;
+    size_t capacity, start, end;
+
+    // last position of each hash, as base + index into the block; entries
+    // below base belong to earlier blocks, so the table is never cleared
+    // between blocks
+    uint32_t table[1 << HASH_LOG];
+    uint32_t base;
+} PayloadCompressorHead;
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Bytes following the token for a length whose nibble is 15.
+static size_t extraBytes(size_t length) {
+    return length >= 15 ? (length - 15) / 255 + 1 : 0;
+}
+
+static uint8_t *putLength(uint8_t *op, size_t length) {
+    for (length -= 15; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t) length;
+    return op;
+}
+
+static uint8_t *putLiterals(uint8_t *op, const uint8_t *literals, size_t count,
+                            size_t matchLength) {
+    size_t matchNibble = matchLength >= MIN_MATCH ? matchLength - MIN_MATCH : 0;
+    *op++ = (uint8_t) ((count < 15 ? count : 15) << 4 | (matchNibble < 15 ? matchNibble : 15));
+    if (count >= 15) {
+        op = putLength(op, count);
+    }
+    memcpy(op, literals, count);
+    return op + count;
+}
+
+// Compresses as much of src as fits into capacity bytes of dst, the bytes
+// taken are returned in consumed.
+static size_t compressBlock(PayloadCompressor c, const uint8_t *src, size_t srcSize,
+                            uint8_t *dst, size_t capacity, size_t *consumed) {
+    size_t ip = 0, anchor = 0, op = 0;
+    unsigned misses = 0;
+
+    while (srcSize >= MIN_MATCH && ip <= srcSize - MIN_MATCH) {
+        uint32_t sequence = read32(src + ip);
+        unsigned h = hash(sequence);
+        uint32_t candidate = c->table[h];
+        c->table[h] = c->base + (uint32_t) ip;
+
+        size_t ref = candidate - c->base;
+        if (candidate < c->base || ip - ref > MAX_OFFSET || read32(src + ref) != sequence) {
+            ip += 1 + (misses++ >> SKIP_STRENGTH);
+            continue;
+        }
+
+        size_t matchLength = MIN_MATCH;
+        while (ip + matchLength < srcSize && src[ref + matchLength] == src[ip + matchLength]) {
+            ++matchLength;
+        }
+        size_t literals = ip - anchor;
+        size_t cost = 1 + extraBytes(literals) + literals + 2 +
+                      extraBytes(matchLength - MIN_MATCH);
+        if (op + cost > capacity) {
+            break;
+        }
+
+        uint8_t *p = putLiterals(dst + op, src + anchor, literals, matchLength);
+        *p++ = (uint8_t) ((ip - ref) & 0xff);
+        *p++ = (uint8_t) ((ip - ref) >> 8);
+        if (matchLength - MIN_MATCH >= 15) {
+            p = putLength(p, matchLength - MIN_MATCH);
+        }
+        op = p - dst;
+        ip += matchLength;
+        anchor = ip;
+        misses = 0;
+    }
+
+    // the rest as literals, as many as fit
+    size_t literals = srcSize - anchor;
+    size_t room = capacity - op;
+    if (1 + extraBytes(literals) + literals > room) {
+        literals = room > 0 ? room - 1 : 0;
+        while (literals > 0 && 1 + extraBytes(literals) + literals > room) {
+            --literals;
+        }
+    }
+    if (literals > 0) {
+        op = putLiterals(dst + op, src + anchor, literals, 0) - dst;
+    }
+    *consumed = anchor + literals;
+
+    // positions of the next block start above this one's
+    if (c->base > UINT32_MAX - 2 * (uint32_t) c->capacity) {
+        memset(c->table, 0, sizeof(c->table));
+        c->base = 1;
+    } else {
+        c->base += (uint32_t) srcSize;
+    }
+    return op;
+}
+
+PayloadCompressor createPayloadCompressor(FILE *input, uint64_t length, size_t payloadSize) {
+    PayloadCompressor compressor = (PayloadCompressor) calloc(1, sizeof(*compressor));
+    compressor->input = input;
+    compressor->unread = length;
+    compressor->payloadSize = payloadSize;
+    compressor->blockSize = payloadSize * MAX_COMPRESSION_RATIO;
+    // moving the unconsumed rest to the front costs at most a third of a
+    // copy per byte
+    compressor->capacity = 4 * compressor->blockSize;
+    compressor->buffer = (uint8_t *) malloc(compressor->capacity);
+    compressor->base = 1;
+    return compressor;
+}
+
+void destroyPayloadCompressor(PayloadCompressor compressor) {
+    free(compressor->buffer);
+    free(compressor);
+}
+
+void setCompressorPayloadSize(PayloadCompressor compressor, size_t payloadSize) {
+    if (payloadSize < compressor->payloadSize) {
+        compressor->payloadSize = payloadSize;
+        compressor->blockSize = payloadSize * MAX_COMPRESSION_RATIO;
+    }
+}
+
+// Makes sure a whole block is buffered unless the range ends before.
+static void readAhead(PayloadCompressor c) {
+    if (c->end - c->start >= c->blockSize || c->unread == 0) {
+        return;
+    }
+    if (c->start + c->blockSize > c->capacity) {
+        memmove(c->buffer, c->buffer + c->start, c->end - c->start);
+        c->end -= c->start;
+        c->start = 0;
+    }
+    size_t count = c->capacity - c->end < c->unread ? c->capacity - c->end
+                                                     : (size_t) c->unread;
+    size_t bytesRead = fread(c->buffer + c->end, 1, count, c->input);
+    if (bytesRead < count) {
+        if (ferror(c->input)) {
+            perror("fread");
+            exit(1);
+        }
+        c->unread = bytesRead;  // the file is shorter than the range
+    }
+    c->end += bytesRead;
+    c->unread -= bytesRead;
+}
+
+size_t compressPayload(PayloadCompressor compressor, void *payload, size_t *consumed,
+                       bool *compressed) {
+    readAhead(compressor);
+
+    const uint8_t *block = compressor->buffer + compressor->start;
+    size_t available = compressor->end - compressor->start;
+    if (available > compressor->blockSize) {
+        available = compressor->blockSize;
+    }
+
+    size_t size = 0;
+    *consumed = 0;
+    if (compressor->skip > 0) {
+        --compressor->skip;
+    } else {
+        size = compressBlock(compressor, block, available, (uint8_t *) payload,
+                             compressor->payloadSize, consumed);
+        if (size < *consumed) {
+            compressor->backoff = 0;
+        } else {
+            compressor->backoff = compressor->backoff == 0 ? 1 : compressor->backoff * 2;
+            if (compressor->backoff > MAX_BACKOFF) {
+                compressor->backoff = MAX_BACKOFF;
+            }
+            compressor->skip = compressor->backoff;
+        }
+    }
+    *compressed = size < *consumed;
+    if (!*compressed) {
+        *consumed = available < compressor->payloadSize ? available : compressor->payloadSize;
+        memcpy(payload, block, *consumed);
+        size = *consumed;
+    }
+    compressor->start += *consumed;
+    return size;
+}
+
+bool decompressPayload(const void *src, size_t size, void *dst, size_t capacity,
+                       size_t *length) {
+    const uint8_t *in = (const uint8_t *) src;
+    uint8_t *out = (uint8_t *) dst;
+    size_t ip = 0, op = 0;
+
+    while (ip < size) {
+        uint8_t token = in[ip++];
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t more;
+            do {
+                if (ip >= size) return false;
+                more = in[ip++];
+                literals += more;
+            } while (more == 255);
+        }
+        if (literals > size - ip || literals > capacity - op) {
+            return false;
+        }
+        if (out != NULL) {
+            memcpy(out + op, in + ip, literals);
+        }
+        ip += literals;
+        op += literals;
+        if (ip == size) {
+            break;  // the last sequence has no match
+        }
+
+        if (size - ip < 2) {
+            return false;
+        }
+        size_t offset = in[ip] | (size_t) in[ip + 1] << 8;
+        ip += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15) {
+            uint8_t more;
+            do {
+                if (ip >= size) return false;
+                more = in[ip++];
+                matchLength += more;
+            } while (more == 255);
+        }
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > op || matchLength > capacity - op) {
+            return false;
+        }
+        if (out == NULL) {
+            op += matchLength;
+        } else if (offset >= matchLength) {
+            memcpy(out + op, out + op - offset, matchLength);
+            op += matchLength;
+        } else {
+            // overlapping: the match repeats the last offset bytes
+            for (size_t i = 0; i < matchLength; ++i, ++op) {
+                out[op] = out[op - offset];
+            }
+        }
+    }
+    *length = op;
+    return true;
+}
@@ -0,0 +1,111 @@
+#include "CongestionControl.h"
+#include <string.h>
+
+#define INITIAL_WINDOW 4.0
+#define MIN_SSTHRESH 2.0
+
+// Vegas thresholds: packets queued in the network
+#define VEGAS_ALPHA 2.0
+#define VEGAS_BETA 4.0
+
+/* fixed: the window is always --window, as before congestion control */
+
+static void fixedInit(CongestionControl *cc) {
+    cc->cwnd = cc->ssthresh = cc->maxWindow;
+}
+
+static void fixedOnAck(CongestionControl *cc, unsigned ackedPackets, long rtt) {
+    (void) cc;
+    (void) ackedPackets;
+    (void) rtt;
+}
+
+static void fixedOnTimeout(CongestionControl *cc) { (void) cc; }
+
+/* aimd: slow start, then one packet more per window of ACKs; a timeout
+ * halves the threshold and starts over with one packet (TCP Reno without
+ * fast recovery) */
+
+static void aimdInit(CongestionControl *cc) {
+    cc->cwnd = INITIAL_WINDOW;
+    cc->ssthresh = cc->maxWindow;
+}
+
+static void aimdOnAck(CongestionControl *cc, unsigned ackedPackets, long rtt) {
+    (void) rtt;
+    for (unsigned i = 0; i < ackedPackets; ++i) {
+        cc->cwnd += cc->cwnd < cc->ssthresh ? 1.0 : 1.0 / cc->cwnd;
+    }
+}
+
+static void aimdOnTimeout(CongestionControl *cc) {
+    double flight = cc->cwnd < cc->maxWindow ? cc->cwnd : cc->maxWindow;
+    cc->ssthresh = flight / 2 > MIN_SSTHRESH ? flight / 2 : MIN_SSTHRESH;
+    cc->cwnd = 1.0;
+}
+
+/* vegas: slow start and timeouts as aimd, in congestion avoidance the
+ * window follows the number of packets queued along the path, estimated
+ * from the RTT increase over the smallest RTT seen */
+
+static void vegasOnAck(CongestionControl *cc, unsigned ackedPackets, long rtt) {
+    if (cc->cwnd < cc->ssthresh || rtt <= 0 || cc->minRtt <= 0) {
+        aimdOnAck(cc, ackedPackets, rtt);
+        return;
+    }
+
+    double queued = cc->cwnd * (double) (rtt - cc->minRtt) / (double) rtt;
+    double step = (double) ackedPackets / cc->cwnd;
+    if (queued < VEGAS_ALPHA) {
+        cc->cwnd += step;
+    } else if (queued > VEGAS_BETA) {
+        cc->cwnd -= step;
+    }
+}
+
+static const CongestionControlOps algorithms[] = {
+        {"fixed", fixedInit, fixedOnAck, fixedOnTimeout},
+        {"aimd",  aimdInit,  aimdOnAck,  aimdOnTimeout},
+        {"vegas", aimdInit,  vegasOnAck, aimdOnTimeout},
+};
+
+static void clampWindow(CongestionControl *cc) {
+    if (cc->cwnd < 1.0) {
+        cc->cwnd = 1.0;
+    }
+    if (cc->cwnd > cc->maxWindow) {
+        cc->cwnd = cc->maxWindow;
+    }
+}
+
+bool initCongestionControl(CongestionControl *cc, const char *name,
+                           unsigned maxWindow) {
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); ++i) {
+        if (strcmp(algorithms[i].name, name) == 0) {
+            cc->ops = &algorithms[i];
+            cc->maxWindow = maxWindow;
+            cc->minRtt = -1;
+            cc->ops->init(cc);
+            clampWindow(cc);
+            return true;
+        }
+    }
+    return false;
+}
+
+void congestionOnAck(CongestionControl *cc, unsigned ackedPackets, long rtt) {
+    if (rtt > 0 && (cc->minRtt < 0 || rtt < cc->minRtt)) {
+        cc->minRtt = rtt;
+    }
+    cc->ops->onAck(cc, ackedPackets, rtt);
+    clampWindow(cc);
+}
+
+void congestionOnTimeout(CongestionControl *cc) {
+    cc->ops->onTimeout(cc);
+    clampWindow(cc);
+}
+
+unsigned getCongestionWindow(const CongestionControl *cc) {
+    return (unsigned) cc->cwnd;
+}
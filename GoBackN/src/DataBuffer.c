@@ -4,29 +4,71 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <string.h>
+
+#define WHEEL_TICK 1000  // usec
+#define WHEEL_SLOTS 256  // level 0: one slot per tick
+#define WHEEL_GROUPS 64  // level 1: one slot per WHEEL_SLOTS ticks
+#define OVERFLOW_BUCKET (WHEEL_SLOTS + WHEEL_GROUPS)  // everything further out
+#define BUCKETS (OVERFLOW_BUCKET + 1)
+#define NIL UINT32_MAX
+
+// Timer of the slot with the same index, linked into one of the buckets.
+// Level 0 holds the ticks [currentTick, currentTick + WHEEL_SLOTS), so all
+// timers of a level 0 bucket expire at the same tick. Level 1 buckets are
+// moved down to level 0 when currentTick reaches their group, the overflow
+// list is sorted in again once per level 1 round.
+typedef struct TimerLink {
+    uint32_t prev, next;
+    uint32_t generation;  // armed if equal to the buffer's generation
+    uint16_t bucket;
+    long tick;
+} TimerLink;
 
 typedef struct DataBufferHead {
     long minSeqNo;
     size_t maxCount;
     size_t firstIndex, freeIndex;
     size_t count;
-    DataPacket **data;
+    size_t packetSize;  // bytes of packet storage per slot
+    DataPacket *data;
+    char *packets;
+
+    TimerLink *links;
+    uint32_t buckets[BUCKETS];
+    uint64_t level0Bits[WHEEL_SLOTS / 64];  // non-empty buckets
+    uint64_t level1Bits;
+    size_t armedCount;
+    long currentTick;  // all earlier ticks have expired
+    uint32_t generation;
 } DataBufferHead;
 
-DataBuffer allocateDataBuffer(size_t maxPacketCount) {
+DataBuffer allocateDataBuffer(size_t maxPacketCount, size_t maxPayloadSize) {
     DataBufferHead *head = (DataBufferHead *) malloc(sizeof(*head));
     head->minSeqNo = 0;
     head->maxCount = maxPacketCount;
     head->firstIndex = head->freeIndex = head->count = 0;
-    head->data = (DataPacket **) calloc(head->maxCount, sizeof(DataPacket *));
+    // keep every packet 8 byte aligned
+    head->packetSize = (sizeof(GoBackNMessageStruct) + maxPayloadSize + 7) & ~(size_t) 7;
+    head->data = (DataPacket *) calloc(head->maxCount, sizeof(DataPacket));
+    head->packets = (char *) calloc(head->maxCount, head->packetSize);
+
+    for (size_t i = 0; i < head->maxCount; ++i) {
+        head->data[i].packet =
+                (GoBackNMessageStruct *) (head->packets + i * head->packetSize);
+    }
+
+    head->links = (TimerLink *) calloc(head->maxCount, sizeof(TimerLink));
+    head->currentTick = 0;
+    head->generation = 0;
+    resetTimers(head);
 
     return head;
 }
 
 void deallocateDataBuffer(DataBuffer buffer) {
-    if (buffer->count > 0) {
-        freeBuffer(buffer, buffer->minSeqNo, buffer->minSeqNo + buffer->count - 1);
-    }
+    free(buffer->links);
+    free(buffer->packets);
     free(buffer->data);
     free(buffer);
 }
@@ -37,44 +79,71 @@ long getLastSeqNoOfBuffer(DataBuffer buffer) {
     return buffer->minSeqNo + buffer->count - 1;
 }
 
+void setFirstSeqNoOfBuffer(DataBuffer buffer, long seqNo) {
+    assert(buffer->count == 0);
+    buffer->minSeqNo = seqNo;
+}
+
 size_t getBufferSize(DataBuffer buffer) { return buffer->count; }
 
 bool bufferContainsPacket(DataBuffer buffer, long seqNo) {
     seqNo -= buffer->minSeqNo;
-    return seqNo >= 0 && seqNo < buffer->count;
+    return seqNo >= 0 && seqNo < (long) buffer->count;
 }
 
 DataPacket *getDataPacketFromBuffer(DataBuffer buffer, long seqNo) {
-    if (seqNo < buffer->minSeqNo || seqNo >= buffer->minSeqNo + buffer->count) {
+    if (seqNo < buffer->minSeqNo || seqNo >= buffer->minSeqNo + (long) buffer->count) {
         return NULL;
     }
-    return buffer->data
+    DataPacket *data = &buffer->data
     [(seqNo - buffer->minSeqNo + buffer->firstIndex) % buffer->maxCount];
+    return data->stored ? data : NULL;
 }
 
-void putDataPacketIntoBuffer(DataBuffer buffer, DataPacket *data) {
+DataPacket *appendDataPacketToBuffer(DataBuffer buffer) {
     assert(buffer->count < buffer->maxCount);
-    assert(data->packet->seqNo >= buffer->minSeqNo);
-    assert(data->packet->seqNo < buffer->minSeqNo + buffer->maxCount);
-    assert((data->packet->seqNo - buffer->minSeqNo + buffer->firstIndex) %
-           buffer->maxCount ==
-           buffer->freeIndex);
 
-    buffer->data[buffer->freeIndex++] = data;
+    DataPacket *data = &buffer->data[buffer->freeIndex++];
     buffer->freeIndex %= buffer->maxCount;
     ++buffer->count;
+
+    data->stored = true;
+    return data;
+}
+
+DataPacket *storeDataPacketInBuffer(DataBuffer buffer, long seqNo) {
+    // compared first, the difference must not overflow for a bogus seqNo
+    if (seqNo < buffer->minSeqNo || seqNo - buffer->minSeqNo >= (long) buffer->maxCount) {
+        return NULL;
+    }
+    long offset = seqNo - buffer->minSeqNo;
+
+    size_t index = (buffer->firstIndex + offset) % buffer->maxCount;
+    if (offset < (long) buffer->count && buffer->data[index].stored) {
+        return NULL;
+    }
+
+    // grow the buffer up to the new packet, leaving holes for missing ones
+    while ((long) buffer->count <= offset) {
+        buffer->data[buffer->freeIndex++].stored = false;
+        buffer->freeIndex %= buffer->maxCount;
+        ++buffer->count;
+    }
+    buffer->data[index].stored = true;
+    return &buffer->data[index];
 }
 
 void freeBuffer(DataBuffer buffer, long start, long end) {
     assert(end >= start);
     assert(start == buffer->minSeqNo);
-    assert(end - start <= buffer->count);
+    assert(end - start < (long) buffer->count);
 
     for (long i = start; i <= end; ++i) {
         assert(i == buffer->minSeqNo);
 
-        free(buffer->data[buffer->firstIndex]->packet);
-        free(buffer->data[buffer->firstIndex++]);
+        cancelPacketTimer(buffer, i);
+        buffer->data[buffer->firstIndex].stored = false;
+        ++buffer->firstIndex;
         buffer->firstIndex %= buffer->maxCount;
         ++buffer->minSeqNo;
         --buffer->count;
@@ -84,19 +153,232 @@ void freeBuffer(DataBuffer buffer, long start, long end) {
 void printBuffer(DataBuffer buffer) {
     printf("%u packets:\n", (unsigned int) buffer->count);
 
-    for (size_t i = buffer->firstIndex; i != buffer->freeIndex;
-         i = (i + 1) % buffer->maxCount) {
-        GoBackNMessageStruct *msg = buffer->data[i]->packet;
+    for (size_t n = 0; n < buffer->count; ++n) {
+        size_t i = (buffer->firstIndex + n) % buffer->maxCount;
+        if (!buffer->data[i].stored) {
+            printf("%ld: missing.\n", buffer->minSeqNo + (long) n);
+            continue;
+        }
+        GoBackNMessageStruct *msg = buffer->data[i].packet;
 
-        printf("%" PRId32 ": %" PRIu32 " data bytes (CRC: %" PRIu32 ").\n",
+        printf("%" PRId64 ": %" PRIu32 " data bytes (CRC: %" PRIu32 ").\n",
                msg->seqNo, msg->size, msg->crcSum);
     }
 }
 
+static bool isArmed(DataBuffer buffer, size_t index) {
+    return buffer->links[index].generation == buffer->generation;
+}
+
+static size_t indexOfSeqNo(DataBuffer buffer, long seqNo) {
+    return (seqNo - buffer->minSeqNo + buffer->firstIndex) % buffer->maxCount;
+}
+
+static long seqNoOfIndex(DataBuffer buffer, size_t index) {
+    return buffer->minSeqNo +
+           (long) ((index + buffer->maxCount - buffer->firstIndex) % buffer->maxCount);
+}
+
+// Distance from bit 'from' to the next set bit, wrapping around, or -1.
+static int findNextBit(const uint64_t *bits, unsigned count, unsigned from) {
+    for (unsigned n = 0; n <= count / 64; ++n) {
+        unsigned word = (from / 64 + n) % (count / 64);
+        uint64_t w = bits[word];
+        if (n == 0) {
+            w &= ~(uint64_t) 0 << (from % 64);
+        } else if (n == count / 64) {
+            w &= ((uint64_t) 1 << (from % 64)) - 1;
+        }
+        if (w != 0) {
+            unsigned bit = word * 64 + __builtin_ctzll(w);
+            return (int) ((bit + count - from) % count);
+        }
+    }
+    return -1;
+}
+
+static void linkTimer(DataBuffer buffer, uint32_t index) {
+    TimerLink *link = &buffer->links[index];
+    if (link->tick < buffer->currentTick) {
+        link->tick = buffer->currentTick;
+    }
+
+    long group = link->tick / WHEEL_SLOTS;
+    long currentGroup = buffer->currentTick / WHEEL_SLOTS;
+    if (link->tick - buffer->currentTick < WHEEL_SLOTS) {
+        link->bucket = link->tick % WHEEL_SLOTS;
+        buffer->level0Bits[link->bucket / 64] |= (uint64_t) 1 << (link->bucket % 64);
+    } else if (group - currentGroup < WHEEL_GROUPS) {
+        link->bucket = WHEEL_SLOTS + group % WHEEL_GROUPS;
+        buffer->level1Bits |= (uint64_t) 1 << (group % WHEEL_GROUPS);
+    } else {
+        link->bucket = OVERFLOW_BUCKET;
+    }
+
+    link->prev = NIL;
+    link->next = buffer->buckets[link->bucket];
+    if (link->next != NIL) {
+        buffer->links[link->next].prev = index;
+    }
+    buffer->buckets[link->bucket] = index;
+    link->generation = buffer->generation;
+}
+
+static void clearBucketBit(DataBuffer buffer, uint16_t bucket) {
+    if (bucket < WHEEL_SLOTS) {
+        buffer->level0Bits[bucket / 64] &= ~((uint64_t) 1 << (bucket % 64));
+    } else if (bucket < OVERFLOW_BUCKET) {
+        buffer->level1Bits &= ~((uint64_t) 1 << (bucket - WHEEL_SLOTS));
+    }
+}
+
+static void unlinkTimer(DataBuffer buffer, uint32_t index) {
+    TimerLink *link = &buffer->links[index];
+    if (link->prev == NIL) {
+        buffer->buckets[link->bucket] = link->next;
+        if (link->next == NIL) {
+            clearBucketBit(buffer, link->bucket);
+        }
+    } else {
+        buffer->links[link->prev].next = link->next;
+    }
+    if (link->next != NIL) {
+        buffer->links[link->next].prev = link->prev;
+    }
+    link->generation = buffer->generation - 1;
+}
+
+// Sorts the timers of a bucket in again relative to currentTick.
+static void relinkBucket(DataBuffer buffer, uint16_t bucket) {
+    uint32_t index = buffer->buckets[bucket];
+    buffer->buckets[bucket] = NIL;
+    clearBucketBit(buffer, bucket);
+
+    while (index != NIL) {
+        uint32_t next = buffer->links[index].next;
+        linkTimer(buffer, index);
+        index = next;
+    }
+}
+
+// currentTick has reached the start of a level 1 group
+static void cascadeTimers(DataBuffer buffer) {
+    long group = buffer->currentTick / WHEEL_SLOTS;
+    if (group % WHEEL_GROUPS == 0) {
+        relinkBucket(buffer, OVERFLOW_BUCKET);
+    }
+    relinkBucket(buffer, WHEEL_SLOTS + group % WHEEL_GROUPS);
+}
+
+static long toTick(const struct timeval *tv) {
+    return tv->tv_sec * (1000000L / WHEEL_TICK) + tv->tv_usec / WHEEL_TICK;
+}
+
+void armPacketTimer(DataBuffer buffer, long seqNo, const struct timeval *now,
+                    const struct timeval *timeout) {
+    assert(getDataPacketFromBuffer(buffer, seqNo) != NULL);
+    size_t index = indexOfSeqNo(buffer, seqNo);
+
+    if (isArmed(buffer, index)) {
+        unlinkTimer(buffer, index);
+    } else {
+        ++buffer->armedCount;
+    }
+    // nothing can have expired in an empty wheel, it starts over at now
+    if (buffer->armedCount == 1 && toTick(now) > buffer->currentTick) {
+        buffer->currentTick = toTick(now);
+    }
+
+    // rounded up, a timer must not expire before its deadline
+    struct timeval deadline;
+    timeradd(now, timeout, &deadline);
+    buffer->links[index].tick = toTick(&deadline) + (deadline.tv_usec % WHEEL_TICK != 0);
+    linkTimer(buffer, index);
+}
+
+void cancelPacketTimer(DataBuffer buffer, long seqNo) {
+    if (!bufferContainsPacket(buffer, seqNo)) {
+        return;
+    }
+    size_t index = indexOfSeqNo(buffer, seqNo);
+    if (isArmed(buffer, index)) {
+        unlinkTimer(buffer, index);
+        --buffer->armedCount;
+    }
+}
+
+bool getNextPacketTimer(DataBuffer buffer, struct timeval *expiration) {
+    if (buffer->armedCount == 0) {
+        return false;
+    }
+
+    long tick = LONG_MAX;
+    int distance = findNextBit(buffer->level0Bits, WHEEL_SLOTS,
+                               buffer->currentTick % WHEEL_SLOTS);
+    if (distance >= 0) {
+        tick = buffer->currentTick + distance;
+    }
+
+    // the start of the next occupied group, its timers may expire later
+    long nextGroup = buffer->currentTick / WHEEL_SLOTS + 1;
+    distance = findNextBit(&buffer->level1Bits, WHEEL_GROUPS, nextGroup % WHEEL_GROUPS);
+    if (distance >= 0 && (nextGroup + distance) * WHEEL_SLOTS < tick) {
+        tick = (nextGroup + distance) * WHEEL_SLOTS;
+    }
+
+    for (uint32_t index = buffer->buckets[OVERFLOW_BUCKET]; index != NIL;
+         index = buffer->links[index].next) {
+        if (buffer->links[index].tick < tick) {
+            tick = buffer->links[index].tick;
+        }
+    }
+
+    expiration->tv_sec = tick / (1000000L / WHEEL_TICK);
+    expiration->tv_usec = tick % (1000000L / WHEEL_TICK) * WHEEL_TICK;
+    return true;
+}
+
+long popExpiredPacketTimer(DataBuffer buffer, const struct timeval *now) {
+    long nowTick = toTick(now);
+
+    while (buffer->armedCount > 0) {
+        uint32_t index = buffer->buckets[buffer->currentTick % WHEEL_SLOTS];
+        if (index != NIL && buffer->currentTick <= nowTick) {
+            unlinkTimer(buffer, index);
+            --buffer->armedCount;
+            return seqNoOfIndex(buffer, index);
+        }
+        if (buffer->currentTick >= nowTick) {
+            return -1;
+        }
+
+        // move on to the next occupied tick, but stop at group boundaries
+        // to cascade the next level 1 bucket
+        long next = nowTick;
+        int distance = findNextBit(buffer->level0Bits, WHEEL_SLOTS,
+                                   (buffer->currentTick + 1) % WHEEL_SLOTS);
+        if (distance >= 0 && buffer->currentTick + 1 + distance < next) {
+            next = buffer->currentTick + 1 + distance;
+        }
+        long boundary = (buffer->currentTick / WHEEL_SLOTS + 1) * WHEEL_SLOTS;
+        if (boundary <= next) {
+            buffer->currentTick = boundary;
+            cascadeTimers(buffer);
+        } else {
+            buffer->currentTick = next;
+        }
+    }
+    return -1;
+}
+
+// Links are invalidated by starting a new generation instead of walking the
+// window.
 void resetTimers(DataBuffer buffer) {
-    for (size_t i = buffer->firstIndex; i != buffer->freeIndex;
-         i = (i + 1) % buffer->maxCount) {
-        buffer->data[i]->timeout.tv_sec = LONG_MAX;
-        buffer->data[i]->timeout.tv_usec = 0;
+    ++buffer->generation;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        buffer->buckets[i] = NIL;
     }
+    memset(buffer->level0Bits, 0, sizeof(buffer->level0Bits));
+    buffer->level1Bits = 0;
+    buffer->armedCount = 0;
 }
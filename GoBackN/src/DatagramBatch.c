@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include "DatagramBatch.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#define MAX_PARTS 2  // iovecs per datagram
+
+typedef struct DatagramBatchHead {
+    size_t capacity;
+    size_t count;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;  // MAX_PARTS per datagram
+    struct sockaddr_storage *addrs;
+} DatagramBatchHead;
+
+DatagramBatch allocateDatagramBatch(size_t capacity) {
+    DatagramBatchHead *head = (DatagramBatchHead *) malloc(sizeof(*head));
+    head->capacity = capacity;
+    head->count = 0;
+    head->msgs = (struct mmsghdr *) calloc(capacity, sizeof(struct mmsghdr));
+    head->iovs = (struct iovec *) calloc(capacity * MAX_PARTS, sizeof(struct iovec));
+    head->addrs = (struct sockaddr_storage *) calloc(
+            capacity, sizeof(struct sockaddr_storage));
+
+    return head;
+}
+
+void deallocateDatagramBatch(DatagramBatch batch) {
+    free(batch->msgs);
+    free(batch->iovs);
+    free(batch->addrs);
+    free(batch);
+}
+
+size_t getBatchCapacity(DatagramBatch batch) { return batch->capacity; }
+
+size_t getBatchCount(DatagramBatch batch) { return batch->count; }
+
+bool addToBatch(DatagramBatch batch, const void *data, size_t size,
+                const struct sockaddr *addr, socklen_t addrlen) {
+    return addPartsToBatch(batch, data, size, NULL, 0, addr, addrlen);
+}
+
+bool addPartsToBatch(DatagramBatch batch, const void *header, size_t headerSize,
+                     const void *payload, size_t payloadSize,
+                     const struct sockaddr *addr, socklen_t addrlen) {
+    if (batch->count == batch->capacity) {
+        return false;
+    }
+
+    size_t i = batch->count++;
+    struct iovec *iov = &batch->iovs[i * MAX_PARTS];
+    iov[0].iov_base = (void *) header;
+    iov[0].iov_len = headerSize;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len = payloadSize;
+
+    struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_iov = iov;
+    hdr->msg_iovlen = payloadSize > 0 ? 2 : 1;
+    if (addr != NULL) {
+        assert(addrlen <= sizeof(batch->addrs[i]));
+        memcpy(&batch->addrs[i], addr, addrlen);
+        hdr->msg_name = &batch->addrs[i];
+        hdr->msg_namelen = addrlen;
+    }
+    return true;
+}
+
+int sendBatch(int s, DatagramBatch batch, int flags) {
+    int retval = sendBatchFrom(s, batch, 0, flags);
+    clearBatch(batch);
+    return retval;
+}
+
+int sendBatchFrom(int s, DatagramBatch batch, size_t first, int flags) {
+    if (first >= batch->count) {
+        return 0;
+    }
+    return sendmmsg(s, batch->msgs + first, batch->count - first, flags);
+}
+
+void clearBatch(DatagramBatch batch) { batch->count = 0; }
+
+int receiveBatch(int s, DatagramBatch batch, void **buffers, size_t count,
+                 size_t bufferSize, int flags) {
+    if (count > batch->capacity) {
+        count = batch->capacity;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        struct iovec *iov = &batch->iovs[i * MAX_PARTS];
+        iov->iov_base = buffers[i];
+        iov->iov_len = bufferSize;
+
+        struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_iov = iov;
+        hdr->msg_iovlen = 1;
+        hdr->msg_name = &batch->addrs[i];
+        hdr->msg_namelen = sizeof(batch->addrs[i]);
+    }
+
+    int retval = recvmmsg(s, batch->msgs, count, flags | MSG_WAITFORONE, NULL);
+    batch->count = retval < 0 ? 0 : (size_t) retval;
+    return retval;
+}
+
+size_t getBatchLength(DatagramBatch batch, size_t index) {
+    assert(index < batch->count);
+    return batch->msgs[index].msg_len;
+}
+
+bool isBatchTruncated(DatagramBatch batch, size_t index) {
+    assert(index < batch->count);
+    return (batch->msgs[index].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+}
+
+const struct sockaddr *getBatchAddress(DatagramBatch batch, size_t index,
+                                       socklen_t *addrlen) {
+    assert(index < batch->count);
+    *addrlen = batch->msgs[index].msg_hdr.msg_namelen;
+    return (const struct sockaddr *) &batch->addrs[index];
+}
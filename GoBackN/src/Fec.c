@@ -0,0 +1,363 @@
+/* Interleaved XOR parity for GoBackN groups, see Fec.h.
+ *
+ * The XOR kernel is picked once at startup like the CRC32 backend: AVX2 or
+ * SSE2 where the CPU has them, 64-bit words otherwise. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Fec.h"
+
+static void xorBytesWords(uint8_t *dst, const uint8_t *src, size_t n) {
+    for (; n >= 8; n -= 8, dst += 8, src += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst, sizeof(a));
+        memcpy(&b, src, sizeof(b));
+        a ^= b;
+        memcpy(dst, &a, sizeof(a));
+    }
+    for (; n > 0; --n) {
+        *dst++ ^= *src++;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void xorBytesSse2(uint8_t *dst, const uint8_t *src, size_t n) {
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *) dst);
+        __m128i a1 = _mm_loadu_si128((const __m128i *) (dst + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i *) (dst + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i *) (dst + 48));
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i *) src));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i *) (src + 16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i *) (src + 32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i *) (src + 48)));
+        _mm_storeu_si128((__m128i *) dst, a0);
+        _mm_storeu_si128((__m128i *) (dst + 16), a1);
+        _mm_storeu_si128((__m128i *) (dst + 32), a2);
+        _mm_storeu_si128((__m128i *) (dst + 48), a3);
+    }
+    xorBytesWords(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static void xorBytesAvx2(uint8_t *dst, const uint8_t *src, size_t n) {
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *) dst);
+        __m256i a1 = _mm256_loadu_si256((const __m256i *) (dst + 32));
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i *) src));
+        a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i *) (src + 32)));
+        _mm256_storeu_si256((__m256i *) dst, a0);
+        _mm256_storeu_si256((__m256i *) (dst + 32), a1);
+    }
+    xorBytesWords(dst, src, n);
+}
+#endif
+
+typedef void (*XorKernel)(uint8_t *dst, const uint8_t *src, size_t n);
+
+static XorKernel xorKernel = xorBytesWords;
+
+// runs before main(), so the kernel is never changed while threads are running
+__attribute__((constructor))
+static void selectXorKernel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        xorKernel = xorBytesAvx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        xorKernel = xorBytesSse2;
+    }
+#endif
+}
+
+void xorBytes(void *dst, const void *src, size_t n) {
+    xorKernel((uint8_t *) dst, (const uint8_t *) src, n);
+}
+
+bool parseFecSpec(const char *spec, unsigned *groupSize, unsigned *parityCount) {
+    *parityCount = 1;
+    int retval = sscanf(spec, "%u:%u", groupSize, parityCount);
+    return retval >= 1 && *groupSize > 0 && *groupSize <= MAX_FEC_GROUP &&
+           *parityCount > 0 && *parityCount <= *groupSize;
+}
+
+/* Encoder */
+
+typedef struct FecEncoderHead {
+    unsigned groupSize, parityCount;
+    size_t payloadSize;
+    unsigned count;  // data packets in the current group
+    bool complete;   // parity of the current group handed out, start a new one
+    GoBackNMessageStruct **parity;  // into packets
+    char *packets;
+    size_t *lengths;  // longest payload covered by each parity packet
+} FecEncoderHead;
+
+static ParityInfo *parityInfo(GoBackNMessageStruct *msg) {
+    return (ParityInfo *) msg->data;
+}
+
+FecEncoder createFecEncoder(unsigned groupSize, unsigned parityCount, size_t payloadSize) {
+    FecEncoderHead *encoder = (FecEncoderHead *) calloc(1, sizeof(*encoder));
+    encoder->groupSize = groupSize;
+    encoder->parityCount = parityCount;
+    encoder->payloadSize = payloadSize;
+    encoder->complete = true;
+    // all parity packets in one block, each 8 byte aligned like in DataBuffer
+    size_t packetSize = (sizeof(GoBackNMessageStruct) + sizeof(ParityInfo) + payloadSize + 7) &
+                        ~(size_t) 7;
+    encoder->packets = (char *) calloc(parityCount, packetSize);
+    encoder->parity = (GoBackNMessageStruct **) calloc(parityCount,
+                                                       sizeof(GoBackNMessageStruct *));
+    for (unsigned i = 0; i < parityCount; ++i) {
+        encoder->parity[i] = (GoBackNMessageStruct *) (encoder->packets + i * packetSize);
+    }
+    encoder->lengths = (size_t *) calloc(parityCount, sizeof(size_t));
+    return encoder;
+}
+
+void destroyFecEncoder(FecEncoder encoder) {
+    free(encoder->packets);
+    free(encoder->parity);
+    free(encoder->lengths);
+    free(encoder);
+}
+
+// Starts the group with its first packet, the parity packets take over the
+// fields that are the same for all packets of the transfer.
+static void startGroup(FecEncoder encoder, const GoBackNMessageStruct *first) {
+    for (unsigned i = 0; i < encoder->parityCount; ++i) {
+        GoBackNMessageStruct *parity = encoder->parity[i];
+        memset(parity, 0, sizeof(*parity) + sizeof(ParityInfo) + encoder->lengths[i]);
+        initGoBackNMessageStruct(parity, MESSAGE_PARITY);
+        parity->transferId = first->transferId;
+        parity->streamId = first->streamId;
+        parity->streamCount = first->streamCount;
+        parity->payloadSize = first->payloadSize;
+        parity->seqNo = first->seqNo;
+        parityInfo(parity)->parityCount = (uint8_t) encoder->parityCount;
+        parityInfo(parity)->index = (uint8_t) i;
+        encoder->lengths[i] = 0;
+    }
+    encoder->count = 0;
+    encoder->complete = false;
+}
+
+unsigned addToFecEncoder(FecEncoder encoder, const GoBackNMessageStruct *packet,
+                         const void *payload, bool last) {
+    if (encoder->complete) {
+        startGroup(encoder, packet);
+    }
+
+    size_t length = packet->size - sizeof(*packet);
+    if (length > encoder->payloadSize) {
+        length = encoder->payloadSize;
+    }
+    unsigned i = encoder->count % encoder->parityCount;
+    GoBackNMessageStruct *parity = encoder->parity[i];
+    ParityInfo *info = parityInfo(parity);
+    xorBytes(parity->data + sizeof(ParityInfo), payload, length);
+    info->lengthXor ^= (uint32_t) length;
+    info->offsetXor ^= packet->offset;
+    info->flagsXor ^= packet->flags;
+    if (length > encoder->lengths[i]) {
+        encoder->lengths[i] = length;
+    }
+    ++encoder->count;
+
+    if (encoder->count < encoder->groupSize && !last) {
+        return 0;
+    }
+
+    // a short last group may leave parity packets without any data packet
+    unsigned ready = encoder->count < encoder->parityCount ? encoder->count
+                                                           : encoder->parityCount;
+    for (i = 0; i < ready; ++i) {
+        parity = encoder->parity[i];
+        parityInfo(parity)->groupSize = (uint16_t) encoder->count;
+        parity->size = sizeof(*parity) + sizeof(ParityInfo) + encoder->lengths[i];
+        parity->crcSum = 0;
+        parity->crcSum = crcGoBackNMessageStruct(parity);
+    }
+    encoder->complete = true;
+    return ready;
+}
+
+const GoBackNMessageStruct *getFecParity(FecEncoder encoder, unsigned i) {
+    return encoder->parity[i];
+}
+
+/* Decoder */
+
+// Per group the XOR of everything received for each parity index, data and
+// parity packets alike. Once the parity packet is in and exactly one data
+// packet of its positions is missing, the XOR is that packet.
+typedef struct FecGroup {
+    long firstSeqNo;     // -1 while unused
+    unsigned groupSize;  // taken from the first parity packet
+    uint64_t received;   // data packets by position, also rebuilt ones
+    uint64_t parities;   // parity packets by index
+} FecGroup;
+
+typedef struct FecDecoderHead {
+    unsigned groupSize, parityCount;
+    size_t payloadSize;
+    unsigned groupCount;
+    FecGroup *groups;
+    uint8_t *xors;         // groupCount * parityCount payloads, behind rebuilt
+    uint32_t *lengthXors;  // groupCount * parityCount
+    uint64_t *offsetXors;
+    uint16_t *flagsXors;
+    GoBackNMessageStruct *rebuilt;  // start of the block xors is part of
+} FecDecoderHead;
+
+FecDecoder createFecDecoder(unsigned groupSize, unsigned parityCount, size_t payloadSize,
+                            unsigned window) {
+    FecDecoderHead *decoder = (FecDecoderHead *) calloc(1, sizeof(*decoder));
+    decoder->groupSize = groupSize;
+    decoder->parityCount = parityCount;
+    decoder->payloadSize = payloadSize;
+    // groups the window overlaps, plus the one whose parity is still due
+    decoder->groupCount = (window + groupSize - 1) / groupSize + 2;
+
+    size_t accumulators = (size_t) decoder->groupCount * parityCount;
+    decoder->groups = (FecGroup *) calloc(decoder->groupCount, sizeof(FecGroup));
+    decoder->lengthXors = (uint32_t *) calloc(accumulators, sizeof(uint32_t));
+    decoder->offsetXors = (uint64_t *) calloc(accumulators, sizeof(uint64_t));
+    decoder->flagsXors = (uint16_t *) calloc(accumulators, sizeof(uint16_t));
+    // the packet handed out and the accumulators it is rebuilt from in one
+    // block, allocated once
+    size_t packetSize = (sizeof(GoBackNMessageStruct) + payloadSize + 7) & ~(size_t) 7;
+    char *block = (char *) calloc(1, packetSize + accumulators * payloadSize);
+    decoder->rebuilt = (GoBackNMessageStruct *) block;
+    decoder->xors = (uint8_t *) (block + packetSize);
+    for (unsigned g = 0; g < decoder->groupCount; ++g) {
+        decoder->groups[g].firstSeqNo = -1;
+    }
+    return decoder;
+}
+
+void destroyFecDecoder(FecDecoder decoder) {
+    free(decoder->groups);
+    free(decoder->lengthXors);
+    free(decoder->offsetXors);
+    free(decoder->flagsXors);
+    free(decoder->rebuilt);
+    free(decoder);
+}
+
+// The group seqNo belongs to, its slot is taken over from an older group.
+// NULL for a seqNo of a group that is already gone.
+static FecGroup *findGroup(FecDecoder decoder, long seqNo, unsigned *slot) {
+    long firstSeqNo = seqNo - seqNo % decoder->groupSize;
+    *slot = (unsigned) ((firstSeqNo / decoder->groupSize) % decoder->groupCount);
+    FecGroup *group = &decoder->groups[*slot];
+    if (group->firstSeqNo > firstSeqNo) {
+        return NULL;
+    }
+    if (group->firstSeqNo < firstSeqNo) {
+        size_t first = (size_t) *slot * decoder->parityCount;
+        memset(decoder->xors + first * decoder->payloadSize, 0,
+               decoder->parityCount * decoder->payloadSize);
+        memset(decoder->lengthXors + first, 0, decoder->parityCount * sizeof(uint32_t));
+        memset(decoder->offsetXors + first, 0, decoder->parityCount * sizeof(uint64_t));
+        memset(decoder->flagsXors + first, 0, decoder->parityCount * sizeof(uint16_t));
+        group->firstSeqNo = firstSeqNo;
+        group->groupSize = 0;
+        group->received = 0;
+        group->parities = 0;
+    }
+    return group;
+}
+
+static GoBackNMessageStruct *rebuild(FecDecoder decoder, FecGroup *group, unsigned slot,
+                                     unsigned index) {
+    if (group->groupSize == 0 || !(group->parities & (1ull << index))) {
+        return NULL;
+    }
+    unsigned missing = 0, position = 0;
+    for (unsigned p = index; p < group->groupSize; p += decoder->parityCount) {
+        if (!(group->received & (1ull << p))) {
+            ++missing;
+            position = p;
+        }
+    }
+    size_t accumulator = (size_t) slot * decoder->parityCount + index;
+    uint32_t length = decoder->lengthXors[accumulator];
+    if (missing != 1 || length > decoder->payloadSize) {
+        return NULL;
+    }
+
+    GoBackNMessageStruct *packet = decoder->rebuilt;
+    memset(packet, 0, sizeof(*packet));
+    initGoBackNMessageStruct(packet, MESSAGE_DATA);
+    packet->seqNo = group->firstSeqNo + position;
+    packet->offset = decoder->offsetXors[accumulator];
+    packet->flags = decoder->flagsXors[accumulator];
+    packet->payloadSize = (uint32_t) decoder->payloadSize;
+    packet->size = sizeof(*packet) + length;
+    memcpy(packet->data, decoder->xors + accumulator * decoder->payloadSize, length);
+    group->received |= 1ull << position;
+    return packet;
+}
+
+GoBackNMessageStruct *addToFecDecoder(FecDecoder decoder, const GoBackNMessageStruct *msg) {
+    unsigned slot;
+    FecGroup *group = findGroup(decoder, msg->seqNo, &slot);
+    if (group == NULL) {
+        return NULL;
+    }
+
+    const uint8_t *data;
+    size_t length;
+    uint32_t lengthXor;
+    uint64_t offsetXor;
+    uint16_t flagsXor;
+    unsigned index;
+    if (msg->type == MESSAGE_PARITY) {
+        const ParityInfo *info = (const ParityInfo *) msg->data;
+        if (msg->size < sizeof(*msg) + sizeof(ParityInfo) ||
+            msg->size - sizeof(*msg) - sizeof(ParityInfo) > decoder->payloadSize ||
+            msg->seqNo != group->firstSeqNo || info->parityCount != decoder->parityCount ||
+            info->index >= decoder->parityCount || info->groupSize > decoder->groupSize ||
+            (group->parities & (1ull << info->index))) {
+            return NULL;
+        }
+        index = info->index;
+        group->parities |= 1ull << index;
+        group->groupSize = info->groupSize;
+        data = (const uint8_t *) msg->data + sizeof(ParityInfo);
+        length = msg->size - sizeof(*msg) - sizeof(ParityInfo);
+        lengthXor = info->lengthXor;
+        offsetXor = info->offsetXor;
+        flagsXor = info->flagsXor;
+    } else {
+        unsigned position = (unsigned) (msg->seqNo - group->firstSeqNo);
+        if (group->received & (1ull << position)) {
+            return NULL;  // duplicate
+        }
+        index = position % decoder->parityCount;
+        group->received |= 1ull << position;
+        data = (const uint8_t *) msg->data;
+        length = msg->size - sizeof(*msg);
+        lengthXor = (uint32_t) length;
+        offsetXor = msg->offset;
+        flagsXor = msg->flags;
+    }
+    if (length > decoder->payloadSize) {
+        return NULL;
+    }
+
+    size_t accumulator = (size_t) slot * decoder->parityCount + index;
+    xorBytes(decoder->xors + accumulator * decoder->payloadSize, data, length);
+    decoder->lengthXors[accumulator] ^= lengthXor;
+    decoder->offsetXors[accumulator] ^= offsetXor;
+    decoder->flagsXors[accumulator] ^= flagsXor;
+    return rebuild(decoder, group, slot, index);
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stddef.h>
 #include "GoBackNMessageStruct.h"
 #include "CRC.h"
 
@@ -12,9 +13,70 @@ GoBackNMessageStruct *allocateGoBackNMessageStruct(size_t dataSize) {
 
 void freeGoBackNMessageStruct(GoBackNMessageStruct *msg) { free(msg); }
 
+void initGoBackNMessageStruct(GoBackNMessageStruct *msg, MessageType type) {
+    msg->version = GOBACKN_VERSION;
+    msg->type = (uint8_t) type;
+    msg->flags = 0;
+}
+
+bool isValidGoBackNMessage(const GoBackNMessageStruct *msg, size_t length) {
+    if (length < sizeof(*msg) || msg->size != length || msg->version != GOBACKN_VERSION) {
+        return false;
+    }
+    switch ((MessageType) msg->type) {
+        case MESSAGE_DATA:
+            return msg->seqNo >= 0 && msg->payloadSize > 0 &&
+                   length - sizeof(*msg) <= msg->payloadSize &&
+                   msg->streamId < msg->streamCount;
+        case MESSAGE_ACK:
+            // seqNo -1: only the cumulative part
+            return length == sizeof(*msg) && msg->seqNo >= -1 && msg->seqNoExpected >= 0;
+        case MESSAGE_RESUME:
+            return length == sizeof(*msg) && msg->streamId < msg->streamCount;
+        case MESSAGE_VERIFY:
+            return length == sizeof(*msg) || length == sizeof(*msg) + sizeof(RangeChecksum);
+        case MESSAGE_PARITY: {
+            if (length < sizeof(*msg) + sizeof(ParityInfo)) {
+                return false;
+            }
+            const ParityInfo *info = (const ParityInfo *) msg->data;
+            return msg->seqNo >= 0 && msg->payloadSize > 0 &&
+                   length - sizeof(*msg) - sizeof(ParityInfo) <= msg->payloadSize &&
+                   info->groupSize > 0 && info->groupSize <= MAX_FEC_GROUP &&
+                   info->index < info->parityCount;
+        }
+        default:
+            return false;
+    }
+}
+
 uint32_t crcGoBackNMessageStruct(GoBackNMessageStruct *msg) {
     uint32_t crc = 0;
     crc32((void *) msg, (size_t) msg->size, &crc);
 
     return (crc);
 }
+
+bool checkCrcGoBackNMessageStruct(const GoBackNMessageStruct *msg) {
+    static const uint8_t zero[sizeof(msg->crcSum)];
+    const size_t before = offsetof(GoBackNMessageStruct, crcSum);
+    const size_t after = before + sizeof(msg->crcSum);
+
+    // the same bytes the sender's CRC covered, with zeros in place of crcSum
+    uint32_t crc = 0;
+    crc32(msg, before, &crc);
+    crc32(zero, sizeof(zero), &crc);
+    crc32((const char *) msg + after, msg->size - after, &crc);
+    return crc == msg->crcSum;
+}
+
+bool parseTransferMode(const char *name, TransferMode *mode) {
+    if (strcmp(name, "gobackn") == 0) {
+        *mode = MODE_GOBACKN;
+    } else if (strcmp(name, "selective") == 0) {
+        *mode = MODE_SELECTIVE;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#include "Log.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+int logLevel = LEVEL_WARNING;
+
+void logMessage(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    flockfile(stderr);
+    if (level == LEVEL_ERROR) {
+        fputs("ERROR: ", stderr);
+    } else if (level == LEVEL_WARNING) {
+        fputs("WARNING: ", stderr);
+    }
+    vfprintf(stderr, format, args);
+    funlockfile(stderr);
+
+    va_end(args);
+}
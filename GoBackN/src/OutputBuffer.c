@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "OutputBuffer.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define BUFFER_ALIGNMENT 4096
+#define PREALLOCATION_CHUNK (64L * 1024 * 1024)
+
+typedef struct OutputBufferHead {
+    int fd;
+    char *data;
+    // with io the previous buffer is written from spare meanwhile
+    AsyncIo *io;
+    char *spare;
+    AsyncWrite write;
+    size_t capacity;
+    size_t count;
+    off_t offset;         // file position of data[0]
+    off_t preallocated;   // disk space reserved up to here
+} OutputBufferHead;
+
+OutputBuffer openOutputRange(int fd, off_t offset, size_t capacity, AsyncIo *io) {
+    OutputBufferHead *head = (OutputBufferHead *) calloc(1, sizeof(*head));
+    if (posix_memalign((void **) &head->data, BUFFER_ALIGNMENT, capacity) != 0) {
+        free(head);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (io != NULL &&
+        posix_memalign((void **) &head->spare, BUFFER_ALIGNMENT, capacity) != 0) {
+        free(head->data);
+        free(head);
+        errno = ENOMEM;
+        return NULL;
+    }
+    head->io = io;
+    head->fd = fd;
+    head->capacity = capacity;
+    head->count = 0;
+    head->offset = head->preallocated = offset;
+
+    return head;
+}
+
+// Reserves the next extent without changing the file size; file systems
+// without support simply allocate on write.
+static void preallocate(OutputBuffer out, off_t end) {
+    if (end <= out->preallocated) {
+        return;
+    }
+#ifdef FALLOC_FL_KEEP_SIZE
+    if (fallocate(out->fd, FALLOC_FL_KEEP_SIZE, out->preallocated,
+                  PREALLOCATION_CHUNK) == 0) {
+        out->preallocated += PREALLOCATION_CHUNK;
+        return;
+    }
+#endif
+    out->preallocated = end;
+}
+
+void flushOutputBuffer(OutputBuffer out) {
+    if (out->io != NULL) {
+        waitAsyncWrite(out->io, &out->write);
+    }
+    preallocate(out, out->offset + out->count);
+
+    size_t written = 0;
+    while (written < out->count) {
+        ssize_t retval = pwrite(out->fd, out->data + written,
+                                out->count - written, out->offset + written);
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("pwrite");
+            exit(1);
+        }
+        written += retval;
+    }
+    out->offset += out->count;
+    out->count = 0;
+}
+
+// Starts writing the full buffer and continues in the spare one, which is
+// free once its own write has completed.
+static void writeBehind(OutputBuffer out) {
+    preallocate(out, out->offset + out->count);
+    waitAsyncWrite(out->io, &out->write);
+    startAsyncWrite(out->io, &out->write, out->fd, out->data, out->count, out->offset);
+
+    char *full = out->data;
+    out->data = out->spare;
+    out->spare = full;
+    out->offset += out->count;
+    out->count = 0;
+}
+
+void appendToOutputBuffer(OutputBuffer out, const void *data, size_t size) {
+    while (size > 0) {
+        size_t chunk = out->capacity - out->count;
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(out->data + out->count, data, chunk);
+        out->count += chunk;
+        data = (const char *) data + chunk;
+        size -= chunk;
+
+        if (out->count == out->capacity) {
+            if (out->io != NULL) {
+                writeBehind(out);
+            } else {
+                flushOutputBuffer(out);
+            }
+        }
+    }
+}
+
+void closeOutputBuffer(OutputBuffer out) {
+    flushOutputBuffer(out);
+    free(out->data);
+    free(out->spare);
+    free(out);
+}
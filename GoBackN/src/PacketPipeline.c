@@ -0,0 +1,289 @@
+#include "PacketPipeline.h"
+#include "Compression.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define CACHE_LINE 64
+
+// Positions count packets since the start of the file, the packet at
+// position n is in slot n % depth. Each position is written by one thread
+// only (release) and read by its neighbours (acquire):
+//   consumed <= taken <= checksummed by every worker <= read <= consumed + depth
+// The consumer keeps the packets it has taken until it releases them
+// (consumed), only taken is private to it.
+// Worker k checksums the packets k, k + K, k + 2K, ... of K workers.
+typedef struct ChecksumWorker {
+    pthread_t thread;
+    struct PacketPipelineHead *pipeline;
+    uint64_t next __attribute__((aligned(CACHE_LINE)));  // next position to checksum
+} __attribute__((aligned(CACHE_LINE))) ChecksumWorker;
+
+typedef struct PacketPipelineHead {
+    uint64_t read __attribute__((aligned(CACHE_LINE)));
+    uint64_t consumed __attribute__((aligned(CACHE_LINE)));
+    uint64_t taken;
+
+    // threads of a stage that are about to sleep, the stage before it wakes
+    // them up; the consumer is woken through the eventfd
+    unsigned readerWaiting __attribute__((aligned(CACHE_LINE)));
+    unsigned checksumWaiting;
+    bool consumerWaiting;
+    bool stopping;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t readerCond;
+    pthread_cond_t checksumCond;
+    int eventFd;
+
+    FILE *input;
+    PayloadCompressor compressor;  // NULL: payloads are sent as read
+    uint64_t offset;     // of the next payload in the file
+    uint64_t remaining;  // bytes of the range not read yet
+    size_t payloadSize;  // set by the consumer, taken by the reader per packet
+    GoBackNMessageStruct header;  // transferId and stream fields
+    size_t depth;
+    size_t packetSize;  // bytes per slot
+    char *packets;
+
+    pthread_t reader;
+    unsigned workerCount;
+    ChecksumWorker *workers;
+} PacketPipelineHead;
+
+static GoBackNMessageStruct *slot(PacketPipeline pipeline, uint64_t position) {
+    return (GoBackNMessageStruct *) (pipeline->packets +
+                                     (position % pipeline->depth) * pipeline->packetSize);
+}
+
+static uint64_t load(const uint64_t *position) {
+    return __atomic_load_n(position, __ATOMIC_ACQUIRE);
+}
+
+// Sequentially consistent, so that either the waiting stage sees the new
+// position or the publishing stage sees the waiting count.
+static void publish(uint64_t *position, uint64_t value) {
+    __atomic_store_n(position, value, __ATOMIC_SEQ_CST);
+}
+
+static void wake(PacketPipeline pipeline, unsigned *waiting, pthread_cond_t *cond) {
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pipeline->mutex);
+        pthread_cond_broadcast(cond);
+        pthread_mutex_unlock(&pipeline->mutex);
+    }
+}
+
+// Sleeps until ready() holds or the pipeline stops. Returns false on stop.
+static bool waitFor(PacketPipeline pipeline, unsigned *waiting, pthread_cond_t *cond,
+                    bool (*ready)(PacketPipeline, void *), void *arg) {
+    if (ready(pipeline, arg)) {
+        return true;
+    }
+    pthread_mutex_lock(&pipeline->mutex);
+    __atomic_add_fetch(waiting, 1, __ATOMIC_SEQ_CST);
+    while (!pipeline->stopping && !ready(pipeline, arg)) {
+        pthread_cond_wait(cond, &pipeline->mutex);
+    }
+    __atomic_sub_fetch(waiting, 1, __ATOMIC_SEQ_CST);
+    bool stopping = pipeline->stopping;
+    pthread_mutex_unlock(&pipeline->mutex);
+    return !stopping;
+}
+
+static bool hasFreeSlot(PacketPipeline pipeline, void *arg) {
+    (void) arg;
+    return pipeline->read - load(&pipeline->consumed) < pipeline->depth;
+}
+
+static bool hasReadPacket(PacketPipeline pipeline, void *arg) {
+    ChecksumWorker *worker = (ChecksumWorker *) arg;
+    return worker->next < load(&pipeline->read);
+}
+
+static void *runReader(void *arg) {
+    PacketPipeline pipeline = (PacketPipeline) arg;
+
+    for (uint64_t position = 0;; ++position) {
+        if (!waitFor(pipeline, &pipeline->readerWaiting, &pipeline->readerCond,
+                     hasFreeSlot, NULL)) {
+            break;
+        }
+
+        GoBackNMessageStruct *packet = slot(pipeline, position);
+        size_t payloadSize = __atomic_load_n(&pipeline->payloadSize, __ATOMIC_RELAXED);
+        size_t size, bytesRead;
+        bool compressed = false;
+        if (pipeline->compressor != NULL) {
+            setCompressorPayloadSize(pipeline->compressor, payloadSize);
+            size = compressPayload(pipeline->compressor, packet->data, &bytesRead,
+                                   &compressed);
+        } else {
+            size_t count = pipeline->remaining < payloadSize
+                           ? (size_t) pipeline->remaining : payloadSize;
+            bytesRead = count > 0 ? fread(packet->data, 1, count, pipeline->input) : 0;
+            if (bytesRead < count && ferror(pipeline->input)) {
+                perror("fread");
+                exit(1);
+            }
+            size = bytesRead;
+        }
+        *packet = pipeline->header;
+        packet->flags = compressed ? FLAG_COMPRESSED : 0;
+        packet->seqNo = (int64_t) position;
+        packet->payloadSize = (uint32_t) payloadSize;  // announced to the receiver
+        packet->crcSum = 0;
+        packet->offset = pipeline->offset;
+        packet->size = size + sizeof(GoBackNMessageStruct);
+        pipeline->offset += bytesRead;
+        pipeline->remaining -= bytesRead;
+
+        publish(&pipeline->read, position + 1);
+        wake(pipeline, &pipeline->checksumWaiting, &pipeline->checksumCond);
+
+        // the empty packet marks the end of the file
+        if (bytesRead == 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *runChecksumWorker(void *arg) {
+    ChecksumWorker *worker = (ChecksumWorker *) arg;
+    PacketPipeline pipeline = worker->pipeline;
+
+    while (waitFor(pipeline, &pipeline->checksumWaiting, &pipeline->checksumCond,
+                   hasReadPacket, worker)) {
+        GoBackNMessageStruct *packet = slot(pipeline, worker->next);
+        packet->crcSum = crcGoBackNMessageStruct(packet);
+        publish(&worker->next, worker->next + pipeline->workerCount);
+
+        if (__atomic_load_n(&pipeline->consumerWaiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&pipeline->consumerWaiting, false, __ATOMIC_SEQ_CST)) {
+            uint64_t one = 1;
+            if (write(pipeline->eventFd, &one, sizeof(one)) < 0) {
+                // the counter is already non-zero, the consumer wakes up anyway
+            }
+        }
+    }
+    return NULL;
+}
+
+PacketPipeline startPacketPipeline(FILE *input, uint64_t offset, uint64_t length,
+                                   size_t payloadSize, const GoBackNMessageStruct *header,
+                                   size_t depth, unsigned checksumThreads, bool compress) {
+    PacketPipeline pipeline;
+    if (posix_memalign((void **) &pipeline, CACHE_LINE, sizeof(*pipeline)) != 0) {
+        return NULL;
+    }
+    memset(pipeline, 0, sizeof(*pipeline));
+
+    pipeline->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pipeline->eventFd < 0) {
+        free(pipeline);
+        return NULL;
+    }
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->readerCond, NULL);
+    pthread_cond_init(&pipeline->checksumCond, NULL);
+
+    pipeline->input = input;
+    if (compress) {
+        pipeline->compressor = createPayloadCompressor(input, length, payloadSize);
+    }
+    pipeline->offset = offset;
+    pipeline->remaining = length;
+    pipeline->payloadSize = payloadSize;
+    pipeline->header = *header;
+    pipeline->depth = depth;
+    pipeline->packetSize = (sizeof(GoBackNMessageStruct) + payloadSize + 7) & ~(size_t) 7;
+    pipeline->packets = (char *) malloc(depth * pipeline->packetSize);
+
+    pipeline->workerCount = checksumThreads;
+    if (posix_memalign((void **) &pipeline->workers, CACHE_LINE,
+                       checksumThreads * sizeof(ChecksumWorker)) != 0) {
+        exit(1);
+    }
+    for (unsigned i = 0; i < checksumThreads; ++i) {
+        ChecksumWorker *worker = &pipeline->workers[i];
+        worker->pipeline = pipeline;
+        worker->next = i;
+        if (pthread_create(&worker->thread, NULL, runChecksumWorker, worker) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    if (pthread_create(&pipeline->reader, NULL, runReader, pipeline) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    return pipeline;
+}
+
+static bool isReady(PacketPipeline pipeline) {
+    uint64_t position = pipeline->taken;
+    const ChecksumWorker *worker = &pipeline->workers[position % pipeline->workerCount];
+    return position < load(&pipeline->read) && position < load(&worker->next);
+}
+
+const GoBackNMessageStruct *peekPipelinePacket(PacketPipeline pipeline) {
+    if (!isReady(pipeline)) {
+        // ask for the eventfd, then look again: the packet may have become
+        // ready before the flag was seen
+        __atomic_store_n(&pipeline->consumerWaiting, true, __ATOMIC_SEQ_CST);
+        if (!isReady(pipeline)) {
+            return NULL;
+        }
+        __atomic_store_n(&pipeline->consumerWaiting, false, __ATOMIC_SEQ_CST);
+    }
+    return slot(pipeline, pipeline->taken);
+}
+
+void takePipelinePacket(PacketPipeline pipeline) {
+    ++pipeline->taken;
+}
+
+void releasePipelinePackets(PacketPipeline pipeline, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    publish(&pipeline->consumed, pipeline->consumed + count);
+    wake(pipeline, &pipeline->readerWaiting, &pipeline->readerCond);
+}
+
+void setPipelinePayloadSize(PacketPipeline pipeline, size_t payloadSize) {
+    __atomic_store_n(&pipeline->payloadSize, payloadSize, __ATOMIC_RELAXED);
+}
+
+int getPipelineEventFd(PacketPipeline pipeline) {
+    return pipeline->eventFd;
+}
+
+void stopPacketPipeline(PacketPipeline pipeline) {
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->stopping = true;
+    pthread_cond_broadcast(&pipeline->readerCond);
+    pthread_cond_broadcast(&pipeline->checksumCond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    pthread_join(pipeline->reader, NULL);
+    for (unsigned i = 0; i < pipeline->workerCount; ++i) {
+        pthread_join(pipeline->workers[i].thread, NULL);
+    }
+
+    fclose(pipeline->input);
+    if (pipeline->compressor != NULL) {
+        destroyPayloadCompressor(pipeline->compressor);
+    }
+    close(pipeline->eventFd);
+    pthread_mutex_destroy(&pipeline->mutex);
+    pthread_cond_destroy(&pipeline->readerCond);
+    pthread_cond_destroy(&pipeline->checksumCond);
+    free(pipeline->packets);
+    free(pipeline->workers);
+    free(pipeline);
+}
@@ -0,0 +1,62 @@
+#include "RttEstimator.h"
+#include <stdlib.h>
+
+static void updateRto(RttEstimator *est) {
+    long rto = est->baseRto;
+    for (unsigned i = 0; i < est->backoff && rto < RTT_MAX_RTO; ++i) {
+        rto *= 2;
+    }
+
+    if (rto < RTT_MIN_RTO) {
+        rto = RTT_MIN_RTO;
+    }
+    if (rto > RTT_MAX_RTO) {
+        rto = RTT_MAX_RTO;
+    }
+    est->rto = rto;
+}
+
+void initRttEstimator(RttEstimator *est, const struct timeval *initialRto) {
+    est->hasSample = false;
+    est->srtt = est->rttvar = 0;
+    est->baseRto = initialRto->tv_sec * 1000000L + initialRto->tv_usec;
+    est->backoff = 0;
+    updateRto(est);
+}
+
+void addRttSample(RttEstimator *est, const struct timeval *rtt) {
+    long r = rtt->tv_sec * 1000000L + rtt->tv_usec;
+    if (r < 0) {
+        return;
+    }
+
+    if (!est->hasSample) {
+        est->srtt = r;
+        est->rttvar = r / 2;
+        est->hasSample = true;
+    } else {
+        // beta = 1/4, alpha = 1/8
+        est->rttvar = (3 * est->rttvar + labs(est->srtt - r)) / 4;
+        est->srtt = (7 * est->srtt + r) / 8;
+    }
+    est->baseRto = est->srtt + 4 * est->rttvar;
+    est->backoff = 0;
+    updateRto(est);
+}
+
+void backoffRto(RttEstimator *est) {
+    if (est->rto < RTT_MAX_RTO) {
+        ++est->backoff;
+    }
+    updateRto(est);
+}
+
+void resetRtoBackoff(RttEstimator *est) {
+    est->backoff = 0;
+    updateRto(est);
+}
+
+void getRto(const RttEstimator *est, struct timeval *rto) {
+    rto->tv_sec = est->rto / 1000000L;
+    rto->tv_usec = est->rto % 1000000L;
+}
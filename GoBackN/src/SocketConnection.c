@@ -1,8 +1,12 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <netinet/ip6.h>
 #include <netdb.h>
 #include <string.h>
 #include <unistd.h>
@@ -45,7 +49,8 @@ int udp_connect(const char *host, const char *serv) {
     return (sockfd);
 }
 
-int udp_server(const char *host, const char *serv, socklen_t *addrlenp) {
+static int udp_bind(const char *host, const char *serv, socklen_t *addrlenp,
+                    int reuseport) {
     int sockfd, n;
     struct addrinfo hints, *res, *ressave;
 
@@ -66,6 +71,13 @@ int udp_server(const char *host, const char *serv, socklen_t *addrlenp) {
             continue; /* error - try next one */
         }
 
+        if (reuseport &&
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuseport,
+                       sizeof(reuseport)) < 0) {
+            close(sockfd);
+            continue;
+        }
+
         if (bind(sockfd, res->ai_addr, res->ai_addrlen) == 0) {
             break; /* success */
         }
@@ -74,7 +86,9 @@ int udp_server(const char *host, const char *serv, socklen_t *addrlenp) {
     } while ((res = res->ai_next) != NULL);
 
     if (res == NULL) /* errno from final socket() or bind() */ {
-        fprintf(stderr, "udp_server error for %s, %s", host, serv);
+        fprintf(stderr, "udp_server error for %s, %s\n", host, serv);
+        freeaddrinfo(ressave);
+        return -1;
     }
 
     if (addrlenp) {
@@ -85,3 +99,91 @@ int udp_server(const char *host, const char *serv, socklen_t *addrlenp) {
 
     return (sockfd);
 }
+
+int udp_server(const char *host, const char *serv, socklen_t *addrlenp) {
+    return udp_bind(host, serv, addrlenp, 0);
+}
+
+int udp_server_shared(const char *host, const char *serv, socklen_t *addrlenp) {
+    return udp_bind(host, serv, addrlenp, 1);
+}
+
+#define UDP_HEADER_SIZE ((int) sizeof(struct udphdr))
+
+static int socket_family(int sockfd) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+
+    if (getsockname(sockfd, (struct sockaddr *) &addr, &addrlen) < 0) {
+        return AF_UNSPEC;
+    }
+    return addr.ss_family;
+}
+
+int udp_probe_payload(int sockfd) {
+    int val;
+
+    switch (socket_family(sockfd)) {
+        case AF_INET:
+            val = IP_PMTUDISC_DO;
+            if (setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val)) < 0) {
+                return -1;
+            }
+            break;
+
+        case AF_INET6:
+            val = IPV6_PMTUDISC_DO;
+            if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &val, sizeof(val)) < 0) {
+                return -1;
+            }
+            break;
+
+        default:
+            return -1;
+    }
+    return udp_path_payload(sockfd);
+}
+
+int udp_path_payload(int sockfd) {
+    int mtu;
+    socklen_t optlen = sizeof(mtu);
+
+    switch (socket_family(sockfd)) {
+        case AF_INET:
+            if (getsockopt(sockfd, IPPROTO_IP, IP_MTU, &mtu, &optlen) < 0) {
+                return -1;
+            }
+            return mtu - (int) sizeof(struct ip) - UDP_HEADER_SIZE;
+
+        case AF_INET6:
+            if (getsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU, &mtu, &optlen) < 0) {
+                return -1;
+            }
+            return mtu - (int) sizeof(struct ip6_hdr) - UDP_HEADER_SIZE;
+
+        default:
+            return -1;
+    }
+}
+
+void udp_allow_fragmentation(int sockfd) {
+    int val;
+
+    switch (socket_family(sockfd)) {
+        case AF_INET:
+            val = IP_PMTUDISC_DONT;
+            setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val));
+            break;
+
+        case AF_INET6:
+            val = IPV6_PMTUDISC_DONT;
+            setsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &val, sizeof(val));
+            break;
+    }
+}
+
+void udp_set_buffer_size(int sockfd, size_t bytes) {
+    int val = bytes < INT_MAX ? (int) bytes : INT_MAX;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val));
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+}
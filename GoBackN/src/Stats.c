@@ -0,0 +1,54 @@
+#include "Stats.h"
+#include <stdarg.h>
+#include <string.h>
+
+FILE *statsFile = NULL;
+struct timeval statsInterval;
+
+bool openStats(const char *fileName, unsigned intervalMs) {
+    FILE *file = strcmp(fileName, "-") == 0 ? stdout : fopen(fileName, "w");
+    if (file == NULL) {
+        return false;
+    }
+    statsInterval.tv_sec = intervalMs / 1000;
+    statsInterval.tv_usec = (intervalMs % 1000) * 1000;
+    statsFile = file;
+    return true;
+}
+
+bool statsDue(struct timeval *next, const struct timeval *now) {
+    if (timercmp(now, next, <)) {
+        return false;
+    }
+    // after a long stall the next report is one interval from now,
+    // missed reports are not caught up
+    timeradd(next, &statsInterval, next);
+    if (timercmp(next, now, <)) {
+        timeradd(now, &statsInterval, next);
+    }
+    return true;
+}
+
+// Threads of the receiver share the file, a record is written in one piece.
+void writeStats(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    struct timeval wallClock;
+    gettimeofday(&wallClock, NULL);
+
+    flockfile(statsFile);
+    fprintf(statsFile, "{\"time\":%ld.%06ld,", (long) wallClock.tv_sec,
+            (long) wallClock.tv_usec);
+    vfprintf(statsFile, format, args);
+    fputs("}\n", statsFile);
+    fflush(statsFile);
+    funlockfile(statsFile);
+
+    va_end(args);
+}
+
+double statsRate(size_t bytes, size_t lastBytes, const struct timeval *elapsed) {
+    double seconds = elapsed->tv_sec + elapsed->tv_usec / 1e6;
+    return seconds > 0 ? (bytes - lastBytes) / seconds : 0.0;
+}
@@ -0,0 +1,103 @@
+#include "Trace.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+TraceRecord *traceRing = NULL;
+
+static uint64_t traceMask;
+static uint64_t traceCount;  // events recorded so far, updated atomically
+static char traceFileName[PATH_MAX];
+
+static void dumpOnSignal(int signo) {
+    (void) signo;
+    dumpTrace();
+}
+
+bool openTrace(const char *fileName, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    if (strlen(fileName) >= sizeof(traceFileName)) {
+        return false;
+    }
+    strcpy(traceFileName, fileName);
+
+    TraceRecord *ring = (TraceRecord *) calloc(size, sizeof(TraceRecord));
+    if (ring == NULL) {
+        return false;
+    }
+    traceMask = size - 1;
+    traceRing = ring;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dumpOnSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    atexit(dumpTrace);
+    return true;
+}
+
+// A writer owns its slot once it has drawn the position. The position is
+// stored last, so a reader can tell empty slots; a record that is overwritten
+// while it is dumped may come out torn.
+void traceEvent(TraceEvent event, uint32_t transferId, long seqNo, long value) {
+    uint64_t position = __atomic_fetch_add(&traceCount, 1, __ATOMIC_RELAXED);
+    TraceRecord *record = &traceRing[position & traceMask];
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->time = (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+    record->transferId = transferId;
+    record->event = event;
+    record->seqNo = seqNo;
+    record->value = value;
+    __atomic_store_n(&record->position, position + 1, __ATOMIC_RELEASE);
+}
+
+void dumpTrace(void) {
+    if (traceRing == NULL) {
+        return;
+    }
+
+    int fd = open(traceFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.capacity = traceMask + 1;
+
+    const char *data = (const char *) traceRing;
+    size_t remaining = (traceMask + 1) * sizeof(TraceRecord);
+    if (write(fd, &header, sizeof(header)) == (ssize_t) sizeof(header)) {
+        while (remaining > 0) {
+            ssize_t written = write(fd, data, remaining);
+            if (written <= 0) {
+                break;
+            }
+            data += written;
+            remaining -= written;
+        }
+    }
+    close(fd);
+}
+
+const char *traceEventName(uint32_t event) {
+    static const char *names[] = {"?", "send", "retransmit", "ack", "timeout",
+                                  "receive", "corrupt", "ack-sent"};
+    return event < sizeof(names) / sizeof(names[0]) ? names[event] : "?";
+}